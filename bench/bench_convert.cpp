@@ -0,0 +1,87 @@
+//-------------------------------------------------------------------------------
+// Sample conversion benchmark: converts one synthetic record of int8 and int16
+// samples to volts with every conversion kernel this CPU supports and reports
+// Msamples/s and the largest deviation from the scalar result. No scope needed.
+//
+// usage: bench_convert [--reclen N] [--repeat N]
+//-------------------------------------------------------------------------------
+
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <chrono>
+#include <iomanip>
+
+#include "convert.h"
+
+template<typename Fn>
+static double measure(size_t repeat, Fn fn) {
+	fn();		//warm up caches and pages
+	auto start = std::chrono::steady_clock::now();
+	for (size_t r = 0; r < repeat; r++) fn();
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / repeat;
+}
+
+template<typename Sample, typename Out>
+static void run(const char* name, const std::vector<Sample>& samples, const ConvertScale& scale, size_t repeat) {
+	size_t n = samples.size();
+	std::vector<Out> reference(n), volts(n);
+	for (size_t i = 0; i < n; i++) reference[i] = static_cast<Out>((samples[i] - scale.yoff) * scale.ymult + scale.yzero);
+
+	auto report = [&](const char* kernel, double seconds) {
+		double maxError = 0;
+		for (size_t i = 0; i < n; i++) maxError = std::max(maxError, std::fabs(static_cast<double>(volts[i] - reference[i])));
+		std::cout << std::left << std::setw(16) << name << std::setw(8) << kernel << std::right
+			<< std::setw(10) << std::fixed << std::setprecision(1) << n / seconds / 1e6 << " MS/s"
+			<< "   max error " << std::scientific << std::setprecision(2) << maxError << std::defaultfloat << '\n';
+	};
+
+	const ConvertIsa isas[] = { ConvertIsa::Scalar, ConvertIsa::Sse2, ConvertIsa::Avx2, ConvertIsa::Avx512 };
+	for (ConvertIsa isa : isas) {
+		if (isa > bestConvertIsa()) break;
+		double seconds = measure(repeat, [&]() { convertSamples(samples.data(), n, volts.data(), scale, isa); });
+		report(convertIsaName(isa), seconds);
+	}
+	if (sizeof(Sample) == 1) {
+		SampleTable<Out> table(scale);
+		double seconds = measure(repeat, [&]() {
+			table.convert(reinterpret_cast<const int8_t*>(samples.data()), n, volts.data());
+		});
+		report("table", seconds);
+	}
+}
+
+int main(int argc, char** argv) {
+
+	size_t recordLength = 10000000;
+	size_t repeat = 20;
+
+	for (int i = 1; i < argc; i++) {
+		if (!std::strcmp(argv[i], "--reclen") && i + 1 < argc) recordLength = std::strtoull(argv[++i], nullptr, 10);
+		else if (!std::strcmp(argv[i], "--repeat") && i + 1 < argc) repeat = std::strtoull(argv[++i], nullptr, 10);
+		else {
+			std::cout << "usage: bench_convert [--reclen N] [--repeat N]\n";
+			return 1;
+		}
+	}
+
+	std::vector<int8_t> samples8(recordLength);
+	std::vector<int16_t> samples16(recordLength);
+	uint32_t seed = 12345;
+	for (size_t i = 0; i < recordLength; i++) {
+		seed = seed * 1664525 + 1013904223;
+		samples16[i] = static_cast<int16_t>(seed >> 16);
+		samples8[i] = static_cast<int8_t>(seed >> 24);
+	}
+
+	std::cout << "record length: " << recordLength << ", best kernel: " << convertIsaName(bestConvertIsa()) << '\n';
+	ConvertScale scale8{ 4e-3, 0.0, -3.0 };
+	ConvertScale scale16{ 1.5625e-5, 0.0, -768.0 };
+	run<int8_t, double>("int8 -> double", samples8, scale8, repeat);
+	run<int8_t, float>("int8 -> float", samples8, scale8, repeat);
+	run<int16_t, double>("int16 -> double", samples16, scale16, repeat);
+	run<int16_t, float>("int16 -> float", samples16, scale16, repeat);
+	return 0;
+}
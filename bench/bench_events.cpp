@@ -0,0 +1,455 @@
+//-------------------------------------------------------------------------------
+// Acquisition throughput benchmark: runs the pcontrol event loop for a fixed
+// number of events and reports events/s and MB/s. Build with -DMSO44_SIMULATOR=ON
+// to run it against the in-process simulated MSO44, whose trigger rate is set
+// with MSO44_SIM_TRIGGER_RATE (Hz). --width 2 reads 16-bit samples, compare with
+// --width 1 for the transfer time cost of the extra resolution. --transport socket
+// or hislip connects over TCP without VISA, by default to mso44_server on localhost.
+// --stream reads with CURVEStream?, one block per trigger without a query per event.
+// --roi BEGIN:END (s from the trigger) transfers only the samples of that window, given
+// more than once the windows are read one after the other from each single sequence.
+// --check-alloc runs the per-event commands of every readout mode against a scripted
+// transport and fails if any of them allocated on the heap.
+//
+// usage: bench_events [--events N] [--reclen N] [--fastframe N] [--srq | --stream] [--holdoff S] [--csv | --csv-ostream] [--decimate none|minmax|lttb] [--points N] [--no-hugepages] [--chunk BYTES] [--width 1|2] [--transport visa|socket|hislip] [--resource STR] [--roi BEGIN:END]... [--json FILE] [--check-alloc]
+//-------------------------------------------------------------------------------
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cstdlib>
+#include <new>
+#include <memory>
+#include <algorithm>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <filesystem>
+
+#include "visa.h"
+#include "visatype.h"
+#include "vi_c2cpp.h"
+#include "fastframe.h"
+#include "curve_stream.h"
+#include "pipeline.h"
+#include "convert.h"
+#include "csv_writer.h"
+#include "ieee_block.h"
+#include "decimate.h"
+#include "preamble.h"
+#include "latency.h"
+#include "event_timing.h"
+#include "roi.h"
+
+// heap allocations made by the calling thread, counted by the global operator new
+thread_local size_t threadAllocations = 0;
+
+void* operator new(std::size_t size) {
+	threadAllocations++;
+	if (void* p = std::malloc(size > 0 ? size : 1)) return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+// Answers the per-event commands from buffers built up front, so --check-alloc counts
+// the allocations of the client side only
+class ScriptedTransport : public Transport {
+public:
+	explicit ScriptedTransport(size_t recordLength) {
+		std::string length = std::to_string(recordLength);
+		curve_ = "#" + std::to_string(length.size()) + length + std::string(recordLength, '\x10') + "\n";
+	}
+
+	ViStatus write(const ViUInt8* buf, ViUInt32 count, ViUInt32* retCount) override {
+		std::string_view command(reinterpret_cast<const char*>(buf), count);
+		if (command == scpi::triggerState) response_ = scpi::triggered;
+		else if (command.size() >= scpi::curve.size() && command.substr(command.size() - scpi::curve.size()) == scpi::curve) response_ = curve_;
+		else if (command == scpi::curveStream) streaming_ = true;
+		else if (command == scpi::frameTimestamps) response_ = "\"16 Oct 2026 09:30:00.000 001 000 000\"\n";
+		else if (command.size() >= 5 && command.substr(command.size() - 5) == "*opc?") response_ = "1\n";
+		else response_ = std::string_view();
+		*retCount = count;
+		return VI_SUCCESS;
+	}
+
+	ViStatus read(ViUInt8* buf, ViUInt32 count, ViUInt32* retCount) override {
+		if (response_.empty() && streaming_) response_ = curve_;
+		size_t n = std::min<size_t>(count, response_.size());
+		std::memcpy(buf, response_.data(), n);
+		response_.remove_prefix(n);
+		*retCount = static_cast<ViUInt32>(n);
+		return response_.empty() ? VI_SUCCESS : VI_SUCCESS_MAX_CNT;
+	}
+
+	ViStatus setTimeout(ViUInt32) override { return VI_SUCCESS; }
+	ViStatus readStb(ViUInt16* stb) override { *stb = 0x60; return VI_SUCCESS; }
+	ViStatus clear() override {
+		response_ = std::string_view();
+		streaming_ = false;
+		return VI_SUCCESS;
+	}
+	ViStatus enableSrq() override { return VI_SUCCESS; }
+	ViStatus disableSrq() override { return VI_SUCCESS; }
+	ViStatus waitForSrq(ViUInt32) override { return VI_SUCCESS; }
+	void close() override {}
+	TransportKind kind() const override { return TransportKind::Visa; }
+
+private:
+	std::string curve_;
+	std::string_view response_;
+	bool streaming_ = false;
+};
+
+// trigger poll plus curve? readout, SRQ arm and wait, FastFrame sequence and its frame
+// timestamps, a block of the curve stream, two region-of-interest ranges: the commands
+// sent for every event, which must not touch the heap
+int checkCommandAllocations(size_t recordLength, size_t nEvents) {
+	ViSession instr = nextNativeSession();
+	registerTransport(instr, std::make_unique<ScriptedTransport>(recordLength));
+	BufferPool<ViInt8> pool(1, 2 * recordLength, false);
+	RawTransfer<ViInt8> block;
+	block.buffer = pool.acquire();
+	ViChar buffer[80000];		//same as the readout: instrRead reads into it without a size
+	ViUInt32 retCount;
+	size_t nBytes;
+	int64_t scopeTime;
+	WaveformPreamble full;
+	full.nPoints = recordLength;
+	full.xinc = 1;
+	RoiPlan roi;
+	roi.build(full, { { 0, 1e18 }, { 0, 1e18 } });		//the scripted curve? is always the whole record
+
+	auto event = [&]() {
+		instrQuery(instr, scpi::triggerState, retCount, buffer);
+		bool ok = std::string_view(buffer, retCount) == scpi::triggered;
+		instrWrite(instr, scpi::curve, retCount);
+		ok = ReadIeeeBlock(instr, block.buffer->data, block.buffer->capacity, nBytes, retCount) == 0 && nBytes == recordLength && ok;
+		ok = WaitForAcquisition(instr, 1000, retCount) == 0 && ok;
+		ok = AcquireFastFrame(instr, recordLength, 1, block, retCount, buffer) == 0 && ok;
+		ok = ReadFrameTimestamps(instr, 1, &scopeTime, retCount) == 0 && ok;
+		ok = StartCurveStream(instr, retCount) == 0 && ReadStreamedCurve(instr, block, retCount) == 0 && StopCurveStream(instr) == 0 && ok;
+		ok = ReadRoiCurves(instr, roi, block.buffer->data, block.buffer->capacity, 1, nBytes, retCount) == 0 && nBytes == 2 * recordLength && ok;
+		return ok;
+	};
+
+	bool ok = event();						//first call initialises the statistics singletons
+	size_t before = threadAllocations;
+	for (size_t i = 0; i < nEvents; i++) ok = event() && ok;
+	size_t allocations = threadAllocations - before;
+	closeTransport(instr);
+
+	std::cout << "command path allocations: " << allocations << " in " << nEvents << " events\n";
+	if (!ok) {
+		std::cout << "scripted readout failed\n";
+		return 1;
+	}
+	return allocations == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+
+	ViSession defaultRM, instr;
+	ViUInt32 retCount;
+	ViChar buffer[80000];
+	size_t nEvents = 1000;
+	size_t recordLength = 62500;
+	size_t nFrames = 1;
+	bool useSrq = false;
+	bool useStream = false;
+	std::string holdoff = "0.01";
+	bool writeCsv = false;
+	bool csvOstream = false;
+	DecimateMode decimateMode = DecimateMode::None;
+	size_t targetPoints = 20000;
+	bool hugePages = true;
+	size_t chunkSize = blockChunkSize;
+	int sampleWidth = 1;
+	std::string resourceString = "TCPIP0::192.168.0.200::inst0::INSTR";
+	TransportKind transport = TransportKind::Visa;
+	bool resourceGiven = false;
+	std::string jsonFile;							//latency report export, none if empty
+	bool checkAlloc = false;
+	std::vector<TimeWindow> roiWindows;			//whole record if empty
+
+	for (int i = 1; i < argc; i++) {
+		if (!std::strcmp(argv[i], "--events") && i + 1 < argc) nEvents = std::strtoull(argv[++i], nullptr, 10);
+		else if (!std::strcmp(argv[i], "--reclen") && i + 1 < argc) recordLength = std::strtoull(argv[++i], nullptr, 10);
+		else if (!std::strcmp(argv[i], "--fastframe") && i + 1 < argc) nFrames = std::strtoull(argv[++i], nullptr, 10);
+		else if (!std::strcmp(argv[i], "--srq")) useSrq = true;
+		else if (!std::strcmp(argv[i], "--stream")) useStream = true;
+		else if (!std::strcmp(argv[i], "--holdoff") && i + 1 < argc) holdoff = argv[++i];
+		else if (!std::strcmp(argv[i], "--csv")) writeCsv = true;
+		else if (!std::strcmp(argv[i], "--csv-ostream")) writeCsv = csvOstream = true;
+		else if (!std::strcmp(argv[i], "--decimate") && i + 1 < argc) {
+			std::string mode = argv[++i];
+			decimateMode = mode == "minmax" ? DecimateMode::MinMax : mode == "lttb" ? DecimateMode::Lttb : DecimateMode::None;
+		}
+		else if (!std::strcmp(argv[i], "--points") && i + 1 < argc) targetPoints = std::strtoull(argv[++i], nullptr, 10);
+		else if (!std::strcmp(argv[i], "--no-hugepages")) hugePages = false;
+		else if (!std::strcmp(argv[i], "--chunk") && i + 1 < argc) chunkSize = std::strtoull(argv[++i], nullptr, 10);
+		else if (!std::strcmp(argv[i], "--width") && i + 1 < argc) sampleWidth = std::atoi(argv[++i]) == 2 ? 2 : 1;
+		else if (!std::strcmp(argv[i], "--transport") && i + 1 < argc && parseTransportKind(argv[i + 1], transport)) i++;
+		else if (!std::strcmp(argv[i], "--resource") && i + 1 < argc) {
+			resourceString = argv[++i];
+			resourceGiven = true;
+		}
+		else if (!std::strcmp(argv[i], "--roi") && i + 1 < argc) {
+			char* end;
+			TimeWindow window;
+			window.begin = std::strtod(argv[++i], &end);
+			window.end = *end == ':' ? std::strtod(end + 1, nullptr) : window.begin;
+			roiWindows.push_back(window);
+		}
+		else if (!std::strcmp(argv[i], "--json") && i + 1 < argc) jsonFile = argv[++i];
+		else if (!std::strcmp(argv[i], "--check-alloc")) checkAlloc = true;
+		else {
+			std::cout << "usage: bench_events [--events N] [--reclen N] [--fastframe N] [--srq | --stream] [--holdoff S] [--csv | --csv-ostream] [--decimate none|minmax|lttb] [--points N] [--no-hugepages] [--chunk BYTES] [--width 1|2] [--transport visa|socket|hislip] [--resource STR] [--roi BEGIN:END]... [--json FILE] [--check-alloc]\n";
+			return 1;
+		}
+	}
+	if (checkAlloc) return checkCommandAllocations(recordLength, nEvents);
+
+	if (!resourceGiven && transport == TransportKind::Socket) resourceString = "TCPIP0::127.0.0.1::4000::SOCKET";
+	if (!resourceGiven && transport == TransportKind::Hislip) resourceString = "TCPIP0::127.0.0.1::hislip0::INSTR";
+
+	if (InitVisaSession(defaultRM) != 0) return 1;
+	if (ConnectToInstrument(defaultRM, resourceString, VI_NULL, VI_NULL, instr, buffer, transport) != 0) return 1;
+	transportSetTimeout(instr, 10000);
+
+	instrWrite(instr, "header 0", retCount);
+	instrWrite(instr, ScpiCommand<>("horizontal:recordlength ").add(recordLength), retCount);
+	instrWrite(instr, "data:source ch2", retCount);
+	instrWrite(instr, "data:enc sri", retCount);
+	instrWrite(instr, ScpiCommand<>("data:width ").add(sampleWidth), retCount);
+	instrWrite(instr, "data:start 1", retCount);
+	instrWrite(instr, ScpiCommand<>("data:stop ").add(recordLength), retCount);
+
+	PreambleCache preambleCache;
+	WaveformPreamble preamble;
+	auto preambleStart = std::chrono::steady_clock::now();
+	if (preambleCache.get(instr, retCount, preamble) != 0) return 1;
+	double preambleSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - preambleStart).count();
+	RoiPlan roi;
+	if (roi.build(preamble, roiWindows) != 0) return 1;
+	if (roi.size() == 1) instrWrite(instr, ScpiCommand<>("data:start ").add(roi.range(0).first).add(";:data:stop ").add(roi.range(0).last), retCount);
+	else if (roi.size() > 1) {
+		nFrames = 1;		//every range of one waveform, as in pcontrol
+		useStream = false;
+		useSrq = true;
+	}
+	size_t transferPoints = roi.empty() ? recordLength : roi.points();
+	ConvertScale scale = preamble.scale();
+
+	std::filesystem::path csvDir = std::filesystem::temp_directory_path() / "bench_events";
+	if (writeCsv) std::filesystem::create_directories(csvDir);
+
+	// one instantiation of the readout and decode path per sample width
+	auto run = [&](auto sampleType) {
+		using Sample = decltype(sampleType);
+		nFrames = std::max<size_t>(1, std::min(nFrames, nEvents));
+		size_t rawCapacity = transferPoints * nFrames;
+		size_t nBuffers = std::max<size_t>(2, std::min<size_t>(64, (1 << 30) / (rawCapacity * (sizeof(Sample) + sizeof(double)))));
+		BufferPool<Sample> rawPool(nBuffers, rawCapacity, hugePages);
+		BufferPool<double> voltsPool(nBuffers, transferPoints * nFrames, hugePages);
+
+		size_t triggered = 0, polls = 0, bytes = 0;
+		double checksum = 0;
+		double csvSeconds = 0;
+		size_t csvRows = 0;
+		CsvWriter csv;
+		Decimator decimate(decimateMode, targetPoints);
+
+		// decode and storage run on their own threads, as in pcontrol
+		AcquisitionPipeline<RawTransfer<Sample>, DecodedTransfer<Sample>> pipeline(64);
+		pipeline.start(
+			[&](RawTransfer<Sample>& raw, DecodedTransfer<Sample>& decoded) {
+				decoded.volts = voltsPool.acquire();
+				decoded.volts->size = raw.nFrames * raw.recordLength;
+				convertSamples(raw.frame(0), raw.nFrames * raw.recordLength, decoded.volts->data, scale);	//frames are contiguous
+				decoded.raw = std::move(raw);
+			},
+			[&](DecodedTransfer<Sample>& decoded) {
+				const RawTransfer<Sample>& raw = decoded.raw;
+				for (size_t k = 0; k < raw.nFrames; k++) {
+					const double* volts = decoded.volts->data + k * raw.recordLength;
+					checksum += volts[raw.recordLength / 2];
+					if (!writeCsv) continue;
+					auto csvStart = std::chrono::steady_clock::now();
+					const std::vector<uint32_t>& keep = decimate(raw.frame(k), raw.recordLength);
+					csvRows += keep.size();
+					std::filesystem::path filename = csvDir / ("data_" + std::to_string(raw.firstEvent + k) + ".csv");
+					if (csvOstream) {
+						//the pcontrol output loop before CsvWriter, for comparison
+						std::ofstream of(filename, std::ofstream::out | std::ofstream::trunc);
+						for (uint32_t i : keep) {
+							of << std::setprecision(5) << static_cast<double>(i) << "," << volts[i] << '\n';
+						}
+					}
+					else if (csv.open(filename.string())) {
+						LatencyTimer format(LatencyStage::Csv);
+						for (uint32_t i : keep) csv.row(static_cast<double>(i), volts[i]);
+						format.stop();
+						LatencyTimer fileClose(LatencyStage::Close);
+						csv.close();
+					}
+					csvSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - csvStart).count();
+				}
+				rawPool.release(raw.buffer);
+				voltsPool.release(decoded.volts);
+			});
+		// trigger timing: host stamps of every transfer, scope timestamps of FastFrame frames
+		RunTiming runTiming;
+		std::vector<int64_t> scopeTimes(nFrames);
+		bool scopeStamped = false;
+		auto pushTransfer = [&](RawTransfer<Sample>& raw) {
+			bytes += raw.buffer->size * sizeof(Sample);
+			raw.nFrames = std::min(raw.nFrames, nEvents - triggered);
+			raw.firstEvent = triggered + 1;
+			triggered += raw.nFrames;
+			runTiming.record(raw.timing, raw.nFrames, raw.nFrames > 1 && scopeStamped ? scopeTimes.data() : nullptr);
+			latencyStats().addEvents(raw.nFrames);
+			latencyStats().addBytes(raw.buffer->size * sizeof(Sample));
+			pipeline.push(std::move(raw));
+		};
+		auto readCurve = [&](const TransferTiming& timing) {
+			RawTransfer<Sample> raw;
+			size_t nBytes;
+			raw.timing = timing;
+			raw.buffer = rawPool.acquire();
+			LatencyTimer transfer(LatencyStage::Curve);
+			int status;
+			if (roi.size() > 1) status = ReadRoiCurves(instr, roi, raw.buffer->data, raw.buffer->capacity * sizeof(Sample), sizeof(Sample), nBytes, retCount);
+			else {
+				instrWrite(instr, scpi::curve, retCount);
+				status = ReadIeeeBlock(instr, raw.buffer->data, raw.buffer->capacity * sizeof(Sample), nBytes, retCount, chunkSize);
+			}
+			if (status != 0) {
+				rawPool.putBack(raw.buffer);
+				return;
+			}
+			transfer.stop();
+			raw.timing.readout = TransferTiming::Clock::now();
+			raw.buffer->size = nBytes / sizeof(Sample);
+			raw.recordLength = raw.buffer->size;
+			raw.nFrames = 1;
+			pushTransfer(raw);
+		};
+
+		ScpiBatch batch;
+		batch.add("trigger:a:mode normal").add("trigger:a:holdoff:by time").add("trigger:a:holdoff:time " + holdoff);
+		batch.add("data:encdg sribinary").flush(instr, retCount);
+		if (nFrames > 1) {
+			SetupFastFrame(instr, nFrames, retCount);
+			transportSetTimeout(instr, static_cast<ViUInt32>(10000 + 20 * nFrames));
+		}
+		else if (useSrq) {
+			instrWrite(instr, "acquire:stopafter sequence", retCount);
+			if (EnableSrqOnOpc(instr, retCount) != 0) return 1;
+		}
+		uint64_t acquisitionsBefore = 0, acquisitionsAfter = 0;
+		bool countAcquisitions = nFrames == 1 && !useSrq && QueryAcquisitionCount(instr, acquisitionsBefore, retCount, buffer) == 0;	//free-running only, as in pcontrol
+
+		auto start = std::chrono::steady_clock::now();
+		latencyStats().start();
+		runTiming.start();
+
+		if (nFrames > 1) {
+			while (triggered < nEvents) {
+				RawTransfer<Sample> block;
+				block.buffer = rawPool.acquire();
+				if (AcquireFastFrame(instr, transferPoints, nFrames, block, retCount, buffer) != 0) {
+					rawPool.putBack(block.buffer);
+					break;
+				}
+				scopeStamped = ReadFrameTimestamps(instr, nFrames, scopeTimes.data(), retCount) == 0;
+				pushTransfer(block);
+			}
+		}
+		else if (useSrq) {
+			while (triggered < nEvents) {
+				TransferTiming timing;
+				LatencyTimer triggerWait(LatencyStage::TriggerWait);
+				timing.armed = TransferTiming::Clock::now();
+				if (WaitForAcquisition(instr, 10000, retCount) != 0) return 1;
+				timing.triggered = TransferTiming::Clock::now();
+				triggerWait.stop();
+				readCurve(timing);
+			}
+		}
+		else if (useStream) {
+			if (StartCurveStream(instr, retCount) != 0) return 1;
+			auto armed = TransferTiming::Clock::now();
+			while (triggered < nEvents) {
+				RawTransfer<Sample> raw;
+				raw.timing.armed = armed;
+				raw.buffer = rawPool.acquire();
+				if (ReadStreamedCurve(instr, raw, retCount, chunkSize) != 0) {
+					rawPool.putBack(raw.buffer);
+					break;
+				}
+				armed = raw.timing.readout;
+				pushTransfer(raw);
+			}
+			StopCurveStream(instr);
+		}
+
+		// same sequence of commands per event as the pcontrol acquisition loop
+		TransferTiming timing;
+		timing.armed = TransferTiming::Clock::now();
+		while (triggered < nEvents) {
+			instrQuery(instr, scpi::triggerState, retCount, buffer);
+			polls++;
+			if (std::string_view(buffer, retCount) != scpi::triggered) continue;
+			timing.triggered = TransferTiming::Clock::now();
+			latencyStats().record(LatencyStage::TriggerWait, timing.triggered - timing.armed);
+			readCurve(timing);
+			timing.armed = TransferTiming::Clock::now();
+		}
+		double readoutTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (countAcquisitions && QueryAcquisitionCount(instr, acquisitionsAfter, retCount, buffer) == 0 && acquisitionsAfter >= acquisitionsBefore) {
+			runTiming.setScopeAcquisitions(acquisitionsAfter - acquisitionsBefore);
+		}
+		//leave the scope in free-running mode, a server keeps its settings for the next run
+		if (nFrames > 1) DisableFastFrame(instr, retCount);
+		else if (useSrq) {
+			DisableSrq(instr, retCount);
+			instrWrite(instr, "acquire:stopafter runstop", retCount);
+		}
+		pipeline.finish();
+
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "transport:       " << transportKindName(transport) << '\n'
+			<< "events:          " << triggered << '\n'
+			<< "record length:   " << recordLength << '\n'
+			<< "transferred:     " << transferPoints << " points, " << bytes / std::max<size_t>(triggered, 1) << " bytes/event\n"
+			<< "sample width:    " << sizeof(Sample) << " byte\n"
+			<< "frames/transfer: " << nFrames << '\n'
+			<< "elapsed:         " << elapsed << " s (readout " << readoutTime << " s)\n"
+			<< "events/s:        " << triggered / elapsed << '\n'
+			<< "MB/s:            " << bytes / elapsed / 1e6 << '\n'
+			<< "readout/event:   " << readoutTime / triggered * 1e3 << " ms\n"
+			<< "trigger polls:   " << polls << '\n'
+			<< "preamble:        " << preambleSeconds * 1e3 << " ms, " << preambleCache.queries() << " WFMOutpre? query\n"
+			<< "convert kernel:  " << convertIsaName(bestConvertIsa()) << '\n'
+			<< "checksum:        " << checksum << '\n';
+		if (writeCsv) {
+			std::cout << "csv writing:     " << csvSeconds << " s, " << csvRows / csvSeconds / 1e6
+				<< " Mrows/s (" << (csvOstream ? "ostream" : "to_chars") << "), " << csvRows / std::max<size_t>(triggered, 1)
+				<< " rows/event, decimation " << decimateModeName(decimate.mode()) << '\n';
+		}
+		pipeline.printStats();
+		std::cout << "buffer pool:     " << nBuffers << " x " << rawCapacity * sizeof(Sample) << " bytes"
+			<< (rawPool.hugePages() ? " on huge pages" : "") << ", " << rawPool.waits() << " readout waits\n";
+		latencyStats().print(std::cout);
+		runTiming.print(std::cout);
+		if (!jsonFile.empty() && !latencyStats().writeJson(jsonFile)) return 1;
+		return 0;
+	};
+	int result = sampleWidth == 2 ? run(int16_t()) : run(ViInt8());
+
+	closeTransport(instr);
+	viClose(defaultRM);
+	return result;
+}
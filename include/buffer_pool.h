@@ -0,0 +1,135 @@
+#pragma once
+
+// Preallocated waveform buffers recycled between pipeline stages. Buffers are
+// page aligned and, where the OS allows it, backed by 2 MB huge pages; they are
+// allocated once per run so the event loop does not allocate or page fault.
+// One thread acquires buffers and one thread releases them (SPSC free list); a buffer
+// the acquiring thread doesn't pass on goes back with putBack, never with release.
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "spsc_ring.h"
+
+template<typename T>
+struct PooledBuffer {
+	enum Backing { Aligned, HugeTlb, TransparentHuge };
+
+	T* data = nullptr;
+	size_t capacity = 0;			//elements
+	size_t size = 0;				//elements in use
+	size_t bytes = 0;				//allocated bytes
+	Backing backing = Aligned;
+};
+
+template<typename T>
+class BufferPool {
+public:
+	static constexpr size_t pageSize = 4096;
+	static constexpr size_t hugePageSize = 2 << 20;
+
+	// count buffers of capacity elements each
+	BufferPool(size_t count, size_t capacity, bool hugePages) : free_(count), buffers_(count) {
+		putBack_.reserve(count);
+		for (auto& b : buffers_) {
+			allocate(b, capacity, hugePages);
+			free_.tryPush(&b);
+		}
+	}
+
+	BufferPool(const BufferPool&) = delete;
+	BufferPool& operator=(const BufferPool&) = delete;
+
+	~BufferPool() {
+		for (auto& b : buffers_) deallocate(b);
+	}
+
+	// acquiring thread, waits while every buffer is in use downstream
+	PooledBuffer<T>* acquire() {
+		PooledBuffer<T>* b;
+		if (!putBack_.empty()) {
+			b = putBack_.back();
+			putBack_.pop_back();
+		}
+		else if (!free_.tryPop(b)) {
+			waits_++;
+			unsigned spins = 0;
+			while (!free_.tryPop(b)) ringBackoff(spins);
+		}
+		b->size = 0;
+		return b;
+	}
+
+	// releasing thread
+	void release(PooledBuffer<T>* b) {
+		if (b != nullptr) free_.tryPush(std::move(b));
+	}
+
+	// acquiring thread, a buffer it acquired but dropped; acquire() hands it out again
+	void putBack(PooledBuffer<T>* b) {
+		if (b != nullptr) putBack_.push_back(b);
+	}
+
+	size_t count() const { return buffers_.size(); }
+	size_t capacity() const { return buffers_.empty() ? 0 : buffers_[0].capacity; }
+	size_t available() const { return free_.size() + putBack_.size(); }
+	size_t waits() const { return waits_; }
+	bool hugePages() const { return !buffers_.empty() && buffers_[0].backing != PooledBuffer<T>::Aligned; }
+
+private:
+	static size_t roundUp(size_t n, size_t to) { return (n + to - 1) / to * to; }
+
+	static void allocate(PooledBuffer<T>& b, size_t capacity, bool hugePages) {
+		b.capacity = capacity;
+		hugePages = hugePages && capacity * sizeof(T) >= hugePageSize;	//smaller buffers would be mostly padding
+		b.bytes = roundUp(capacity * sizeof(T), hugePages ? hugePageSize : pageSize);
+		void* p = nullptr;
+#ifdef _WIN32
+		p = _aligned_malloc(b.bytes, pageSize);
+#else
+#ifdef MAP_HUGETLB
+		if (hugePages) {
+			//explicit huge pages need a reserved pool (vm.nr_hugepages), fall back if there is none
+			p = mmap(nullptr, b.bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (p == MAP_FAILED) p = nullptr;
+			else b.backing = PooledBuffer<T>::HugeTlb;
+		}
+#endif
+		if (p == nullptr) {
+			if (posix_memalign(&p, hugePages ? hugePageSize : pageSize, b.bytes) != 0) p = nullptr;
+#ifdef MADV_HUGEPAGE
+			if (p != nullptr && hugePages && madvise(p, b.bytes, MADV_HUGEPAGE) == 0) {
+				b.backing = PooledBuffer<T>::TransparentHuge;
+			}
+#endif
+		}
+#endif
+		if (p == nullptr) throw std::bad_alloc();
+		std::memset(p, 0, b.bytes);		//fault all pages in now rather than during the run
+		b.data = static_cast<T*>(p);
+	}
+
+	static void deallocate(PooledBuffer<T>& b) {
+		if (b.data == nullptr) return;
+#ifdef _WIN32
+		_aligned_free(b.data);
+#else
+		if (b.backing == PooledBuffer<T>::HugeTlb) munmap(b.data, b.bytes);
+		else std::free(b.data);
+#endif
+		b.data = nullptr;
+	}
+
+	SpscRing<PooledBuffer<T>*> free_;
+	std::vector<PooledBuffer<T>> buffers_;
+	std::vector<PooledBuffer<T>*> putBack_;		//only touched by the acquiring thread
+	size_t waits_ = 0;
+};
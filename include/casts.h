@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 
 char* str_to_ch (const std::string& buf) {
 	return const_cast<char*>(buf.c_str());
@@ -50,3 +51,8 @@ const unsigned char* str_to_conuch (const std::string& buf) {
 unsigned char* str_to_uch(const std::string& buf) {
     return ch_to_uch(str_to_ch(buf));
 }
+
+//view of a command, no copy and no const_cast
+const unsigned char* sv_to_conuch(std::string_view buf) {
+    return reinterpret_cast<const unsigned char*>(buf.data());
+}
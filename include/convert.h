@@ -0,0 +1,232 @@
+#pragma once
+
+// Conversion of raw int8/int16 samples to volts, volts = (sample - yoff) * ymult + yzero,
+// folded into one multiply-add per sample: volts = sample * a + b.
+// Kernels for SSE2, AVX2 and AVX-512 are compiled into the same binary and the best one
+// supported by the CPU is picked at runtime; 8-bit data can also go through a 256 entry table.
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CONVERT_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define CONVERT_TARGET(isa) __attribute__((target(isa)))
+#else
+#define CONVERT_TARGET(isa)
+#endif
+
+enum class ConvertIsa { Scalar, Sse2, Avx2, Avx512 };
+
+inline const char* convertIsaName(ConvertIsa isa) {
+	switch (isa) {
+	case ConvertIsa::Sse2: return "sse2";
+	case ConvertIsa::Avx2: return "avx2";
+	case ConvertIsa::Avx512: return "avx512";
+	default: return "scalar";
+	}
+}
+
+// Vertical scaling of the transfer, from the WFMOutpre? preamble (WaveformPreamble::scale())
+struct ConvertScale {
+	double ymult = 1, yzero = 0, yoff = 0;
+
+	double a() const { return ymult; }
+	double b() const { return yzero - yoff * ymult; }
+};
+
+// Best instruction set supported by this CPU and OS, detected once
+inline ConvertIsa detectConvertIsa() {
+#ifdef CONVERT_X86
+#if defined(__GNUC__) || defined(__clang__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f")) return ConvertIsa::Avx512;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return ConvertIsa::Avx2;
+	if (__builtin_cpu_supports("sse2")) return ConvertIsa::Sse2;
+#elif defined(_MSC_VER)
+	int r[4];
+	__cpuid(r, 1);
+	bool osxsave = (r[2] & (1 << 27)) != 0, fma = (r[2] & (1 << 12)) != 0, sse2 = (r[3] & (1 << 26)) != 0;
+	unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+	__cpuidex(r, 7, 0);
+	bool avx2 = (r[1] & (1 << 5)) != 0, avx512f = (r[1] & (1 << 16)) != 0;
+	if (avx512f && (xcr0 & 0xe6) == 0xe6) return ConvertIsa::Avx512;	//ymm, zmm and opmask state enabled
+	if (avx2 && fma && (xcr0 & 0x6) == 0x6) return ConvertIsa::Avx2;
+	if (sse2) return ConvertIsa::Sse2;
+#endif
+#endif
+	return ConvertIsa::Scalar;
+}
+
+inline ConvertIsa bestConvertIsa() {
+	static const ConvertIsa isa = detectConvertIsa();
+	return isa;
+}
+
+namespace convert_detail {
+
+template<typename Sample, typename Out>
+inline void scalar(const Sample* src, size_t n, Out* dst, Out a, Out b) {
+	for (size_t i = 0; i < n; i++) dst[i] = static_cast<Out>(src[i]) * a + b;
+}
+
+#ifdef CONVERT_X86
+
+// SSE2: widen to int32 by unpacking and arithmetic shifts, 4 samples per convert
+CONVERT_TARGET("sse2") inline void sse2Store4(__m128i x, float* dst, float a, float b) {
+	_mm_storeu_ps(dst, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(x), _mm_set1_ps(a)), _mm_set1_ps(b)));
+}
+
+CONVERT_TARGET("sse2") inline void sse2Store4(__m128i x, double* dst, double a, double b) {
+	__m128d va = _mm_set1_pd(a), vb = _mm_set1_pd(b);
+	_mm_storeu_pd(dst, _mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(x), va), vb));
+	_mm_storeu_pd(dst + 2, _mm_add_pd(_mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(x, 8)), va), vb));
+}
+
+template<typename Out>
+CONVERT_TARGET("sse2") inline void sse2Store8(__m128i x16, Out* dst, Out a, Out b) {
+	sse2Store4(_mm_srai_epi32(_mm_unpacklo_epi16(x16, x16), 16), dst, a, b);
+	sse2Store4(_mm_srai_epi32(_mm_unpackhi_epi16(x16, x16), 16), dst + 4, a, b);
+}
+
+template<typename Out>
+CONVERT_TARGET("sse2") void sse2(const int8_t* src, size_t n, Out* dst, Out a, Out b) {
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		sse2Store8(_mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8), dst + i, a, b);
+		sse2Store8(_mm_srai_epi16(_mm_unpackhi_epi8(v, v), 8), dst + i + 8, a, b);
+	}
+	scalar(src + i, n - i, dst + i, a, b);
+}
+
+template<typename Out>
+CONVERT_TARGET("sse2") void sse2(const int16_t* src, size_t n, Out* dst, Out a, Out b) {
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		sse2Store8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), dst + i, a, b);
+	}
+	scalar(src + i, n - i, dst + i, a, b);
+}
+
+// AVX2 + FMA: sign extend 8 samples to int32 in one instruction
+CONVERT_TARGET("avx2,fma") inline void avx2Store8(__m256i x, float* dst, float a, float b) {
+	_mm256_storeu_ps(dst, _mm256_fmadd_ps(_mm256_cvtepi32_ps(x), _mm256_set1_ps(a), _mm256_set1_ps(b)));
+}
+
+CONVERT_TARGET("avx2,fma") inline void avx2Store8(__m256i x, double* dst, double a, double b) {
+	__m256d va = _mm256_set1_pd(a), vb = _mm256_set1_pd(b);
+	_mm256_storeu_pd(dst, _mm256_fmadd_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(x)), va, vb));
+	_mm256_storeu_pd(dst + 4, _mm256_fmadd_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(x, 1)), va, vb));
+}
+
+template<typename Out>
+CONVERT_TARGET("avx2,fma") void avx2(const int8_t* src, size_t n, Out* dst, Out a, Out b) {
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		avx2Store8(_mm256_cvtepi8_epi32(v), dst + i, a, b);
+		avx2Store8(_mm256_cvtepi8_epi32(_mm_unpackhi_epi64(v, v)), dst + i + 8, a, b);
+	}
+	scalar(src + i, n - i, dst + i, a, b);
+}
+
+template<typename Out>
+CONVERT_TARGET("avx2,fma") void avx2(const int16_t* src, size_t n, Out* dst, Out a, Out b) {
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		avx2Store8(_mm256_cvtepi16_epi32(v), dst + i, a, b);
+	}
+	scalar(src + i, n - i, dst + i, a, b);
+}
+
+// AVX-512F: 16 samples per convert
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"	//gcc 12 false positive on _mm512_undefined_*()
+#endif
+CONVERT_TARGET("avx512f") inline void avx512Store16(__m512i x, float* dst, float a, float b) {
+	_mm512_storeu_ps(dst, _mm512_fmadd_ps(_mm512_cvtepi32_ps(x), _mm512_set1_ps(a), _mm512_set1_ps(b)));
+}
+
+CONVERT_TARGET("avx512f") inline void avx512Store16(__m512i x, double* dst, double a, double b) {
+	__m512d va = _mm512_set1_pd(a), vb = _mm512_set1_pd(b);
+	_mm512_storeu_pd(dst, _mm512_fmadd_pd(_mm512_cvtepi32_pd(_mm512_castsi512_si256(x)), va, vb));
+	_mm512_storeu_pd(dst + 8, _mm512_fmadd_pd(_mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(x, 1)), va, vb));
+}
+
+template<typename Out>
+CONVERT_TARGET("avx512f") void avx512(const int8_t* src, size_t n, Out* dst, Out a, Out b) {
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		avx512Store16(_mm512_cvtepi8_epi32(v), dst + i, a, b);
+	}
+	scalar(src + i, n - i, dst + i, a, b);
+}
+
+template<typename Out>
+CONVERT_TARGET("avx512f") void avx512(const int16_t* src, size_t n, Out* dst, Out a, Out b) {
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+		avx512Store16(_mm512_cvtepi16_epi32(v), dst + i, a, b);
+	}
+	scalar(src + i, n - i, dst + i, a, b);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif
+
+}
+
+// Converts n samples (int8_t or int16_t, host byte order) to float or double volts in one pass
+template<typename Sample, typename Out>
+inline void convertSamples(const Sample* src, size_t n, Out* dst, const ConvertScale& scale, ConvertIsa isa = bestConvertIsa()) {
+	static_assert(sizeof(Sample) <= 2, "samples are 1 or 2 bytes wide");
+	using S = typename std::conditional<sizeof(Sample) == 1, int8_t, int16_t>::type;
+	const S* s = reinterpret_cast<const S*>(src);
+	Out a = static_cast<Out>(scale.a()), b = static_cast<Out>(scale.b());
+	switch (isa) {
+#ifdef CONVERT_X86
+	case ConvertIsa::Avx512: convert_detail::avx512(s, n, dst, a, b); return;
+	case ConvertIsa::Avx2: convert_detail::avx2(s, n, dst, a, b); return;
+	case ConvertIsa::Sse2: convert_detail::sse2(s, n, dst, a, b); return;
+#endif
+	default: convert_detail::scalar(s, n, dst, a, b); return;
+	}
+}
+
+// Lookup table for 8-bit samples: all 256 possible volts are computed once per preamble
+template<typename Out>
+class SampleTable {
+public:
+	explicit SampleTable(const ConvertScale& scale) {
+		for (int code = -128; code < 128; code++) {
+			table_[static_cast<uint8_t>(code)] = static_cast<Out>((code - scale.yoff) * scale.ymult + scale.yzero);
+		}
+	}
+
+	template<typename Sample>
+	void convert(const Sample* src, size_t n, Out* dst) const {
+		static_assert(sizeof(Sample) == 1, "lookup table is for 8-bit samples");
+		const uint8_t* codes = reinterpret_cast<const uint8_t*>(src);
+		for (size_t i = 0; i < n; i++) dst[i] = table_[codes[i]];
+	}
+
+	Out operator()(int8_t sample) const { return table_[static_cast<uint8_t>(sample)]; }
+
+private:
+	Out table_[256];
+};
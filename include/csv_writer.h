@@ -0,0 +1,118 @@
+#pragma once
+
+// CSV output without iostreams: numbers are formatted with std::to_chars (no locale,
+// no allocation) into one large buffer that is written out in big blocks. Output
+// matches "os << std::setprecision(p) << x" (shortest %g form with p significant digits).
+
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class CsvWriter {
+public:
+	// bufferSize: bytes collected before each write, precision: significant digits
+	explicit CsvWriter(size_t bufferSize = 1 << 20, int precision = 5) : buffer_(bufferSize), precision_(clampPrecision(precision)) {}
+	CsvWriter(const CsvWriter&) = delete;
+	CsvWriter& operator=(const CsvWriter&) = delete;
+	~CsvWriter() { close(); }
+
+	bool open(const std::string& filename) {
+		close();
+		file_ = std::fopen(filename.c_str(), "wb");
+		if (file_ == nullptr) {
+			printf("Error creating %s\n", filename.c_str());
+			return false;
+		}
+		std::setvbuf(file_, nullptr, _IONBF, 0);	//writes already come in large blocks
+		used_ = 0;
+		return true;
+	}
+
+	void close() {
+		if (file_ == nullptr) return;
+		flush();
+		std::fclose(file_);
+		file_ = nullptr;
+	}
+
+	void setPrecision(int precision) { precision_ = clampPrecision(precision); }
+	int precision() const { return precision_; }
+
+	// one "x,y" line
+	void row(double x, double y) {
+		if (buffer_.size() - used_ < 2 * maxNumber + 2) flush();
+		char* p = buffer_.data() + used_;
+		char* end = buffer_.data() + buffer_.size();
+		if (!put(p, end, x) || !put(p, end, ',') || !put(p, end, y) || !put(p, end, '\n')) return;
+		used_ = p - buffer_.data();
+	}
+
+	// one line of n values, e.g. a per-event record; a line longer than the buffer is dropped
+	void row(const double* values, size_t n) {
+		if (buffer_.size() - used_ < n * (maxNumber + 1) + 1) flush();
+		char* p = buffer_.data() + used_;
+		char* end = buffer_.data() + buffer_.size();
+		for (size_t i = 0; i < n; i++) {
+			if ((i > 0 && !put(p, end, ',')) || !put(p, end, values[i])) return;
+		}
+		if (!put(p, end, '\n')) return;
+		used_ = p - buffer_.data();
+	}
+
+	// text as it is, e.g. a header line
+	void text(std::string_view s) {
+		if (buffer_.size() - used_ < s.size()) flush();
+		if (s.size() > buffer_.size()) {
+			std::fwrite(s.data(), 1, s.size(), file_);
+			return;
+		}
+		std::memcpy(buffer_.data() + used_, s.data(), s.size());
+		used_ += s.size();
+	}
+
+	// rows i = 0, step, 2 * step, ... < n of two columns
+	template<typename X, typename Y>
+	void columns(const X* x, const Y* y, size_t n, size_t step = 1) {
+		for (size_t i = 0; i < n; i += step) row(x[i], y[i]);
+	}
+
+	// rows x[index[k]], y[index[k]] for k < n, e.g. the points kept by a Decimator
+	template<typename X, typename Y, typename Index>
+	void rows(const X* x, const Y* y, const Index* index, size_t n) {
+		for (size_t k = 0; k < n; k++) row(x[index[k]], y[index[k]]);
+	}
+
+	void flush() {
+		if (used_ == 0 || file_ == nullptr) return;
+		std::fwrite(buffer_.data(), 1, used_, file_);
+		used_ = 0;
+	}
+
+private:
+	static constexpr int maxPrecision = 17;		//enough to read any double back exactly
+	static constexpr size_t maxNumber = 32;		//a double in %g form up to maxPrecision digits never exceeds it
+
+	static int clampPrecision(int precision) { return precision < 1 ? 1 : precision > maxPrecision ? maxPrecision : precision; }
+
+	// the line in progress is abandoned, used_ unchanged, if it doesn't fit
+	bool put(char*& p, char* end, double value) const {
+		auto result = std::to_chars(p, end, value, std::chars_format::general, precision_);
+		if (result.ec != std::errc()) return false;
+		p = result.ptr;
+		return true;
+	}
+
+	static bool put(char*& p, char* end, char c) {
+		if (p == end) return false;
+		*p++ = c;
+		return true;
+	}
+
+	std::FILE* file_ = nullptr;
+	std::vector<char> buffer_;
+	size_t used_ = 0;
+	int precision_;
+};
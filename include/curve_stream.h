@@ -0,0 +1,56 @@
+#pragma once
+
+// CURVEStream? acquisition: once started, the scope sends a curve? block for every
+// acquisition on its own, back to back, until a device clear ends the stream. There is
+// no arm, poll or query per event, the scope re-arms in hardware and runs at its own
+// maximum trigger rate; waveforms it acquires while the host is behind are overwritten.
+
+#include <cstdio>
+
+#include "visa.h"
+#include "visatype.h"
+#include "vi_c2cpp.h"
+#include "raw_transfer.h"
+#include "ieee_block.h"
+#include "transport.h"
+#include "latency.h"
+
+// Starts the stream with the data source, encoding, width and start/stop already set.
+// A raw socket has no device clear to end the stream with, so it is refused there.
+inline int StartCurveStream(const ViSession& instr, ViUInt32& retCount) {
+	Transport* transport = findTransport(instr);
+	if (transport != nullptr && transport->kind() == TransportKind::Socket) {
+		printf("CURVEStream? needs a device clear to stop, not available over a raw socket\n");
+		return 10;
+	}
+	if (instrWrite(instr, scpi::curveStream, retCount) != 0) return 10;
+	return 0;
+}
+
+// Waits for the next block of the stream and reads it into raw.buffer. The host only
+// sees a waveform when its block arrives, so the trigger and readout stamps are the same.
+// Returns 0 on success, 10 if the block was malformed: the stream is out of step then.
+template<typename Sample>
+int ReadStreamedCurve(const ViSession& instr, RawTransfer<Sample>& raw, ViUInt32& retCount, size_t chunkSize = blockChunkSize) {
+	size_t nBytes;
+	LatencyTimer transfer(LatencyStage::Curve);
+	if (ReadIeeeBlock(instr, raw.buffer->data, raw.buffer->capacity * sizeof(Sample), nBytes, retCount, chunkSize) != 0 || nBytes < sizeof(Sample)) {
+		printf("Error reading the curve stream\n");
+		return 10;
+	}
+	transfer.stop();
+	raw.timing.triggered = raw.timing.readout = TransferTiming::Clock::now();
+	raw.buffer->size = nBytes / sizeof(Sample);
+	raw.recordLength = raw.buffer->size;
+	raw.nFrames = 1;
+	return 0;
+}
+
+// Device clear ends the stream and drops the blocks still on their way
+inline int StopCurveStream(const ViSession& instr) {
+	if (transportClear(instr) < VI_SUCCESS) {
+		printf("Error stopping the curve stream\n");
+		return 10;
+	}
+	return 0;
+}
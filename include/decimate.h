@@ -0,0 +1,283 @@
+#pragma once
+
+// Reduction of a record to a target number of points for storage, working on the raw
+// int8/int16 samples and returning the indices of the points to keep, in order:
+//   min/max  the lowest and the highest sample of each bucket, so narrow pulses and
+//            peaks survive whatever the reduction factor
+//   lttb     Largest-Triangle-Three-Buckets, one point per bucket chosen to keep the
+//            visual shape of the trace
+// Extremes and triangle areas are computed with SSE2/AVX2 kernels picked at runtime
+// like the conversion kernels in convert.h.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#include "convert.h"
+
+enum class DecimateMode { None, MinMax, Lttb };
+
+inline const char* decimateModeName(DecimateMode mode) {
+	switch (mode) {
+	case DecimateMode::MinMax: return "minmax";
+	case DecimateMode::Lttb: return "lttb";
+	default: return "none";
+	}
+}
+
+namespace decimate_detail {
+
+template<typename Sample>
+inline void minMaxScalar(const Sample* src, size_t n, Sample& lo, Sample& hi) {
+	for (size_t i = 0; i < n; i++) {
+		lo = std::min(lo, src[i]);
+		hi = std::max(hi, src[i]);
+	}
+}
+
+// index in [0, n) maximizing |alpha * src[i] + beta * i + gamma|
+template<typename Sample>
+inline size_t argMaxAreaScalar(const Sample* src, size_t n, float alpha, float beta, float gamma) {
+	size_t best = 0;
+	float bestArea = -1;
+	for (size_t i = 0; i < n; i++) {
+		float area = std::fabs(alpha * src[i] + beta * static_cast<float>(i) + gamma);
+		if (area > bestArea) {
+			bestArea = area;
+			best = i;
+		}
+	}
+	return best;
+}
+
+#ifdef CONVERT_X86
+
+// SSE2 has signed 16-bit min/max only, 8-bit samples are flipped to unsigned for min_epu8
+CONVERT_TARGET("sse2") inline void minMaxSse2(const int16_t* src, size_t n, int16_t& lo, int16_t& hi) {
+	size_t i = 0;
+	if (n >= 8) {
+		__m128i vlo = _mm_set1_epi16(lo), vhi = _mm_set1_epi16(hi);
+		for (; i + 8 <= n; i += 8) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+			vlo = _mm_min_epi16(vlo, v);
+			vhi = _mm_max_epi16(vhi, v);
+		}
+		alignas(16) int16_t l[8], h[8];
+		_mm_store_si128(reinterpret_cast<__m128i*>(l), vlo);
+		_mm_store_si128(reinterpret_cast<__m128i*>(h), vhi);
+		minMaxScalar(l, 8, lo, hi);
+		minMaxScalar(h, 8, lo, hi);
+	}
+	minMaxScalar(src + i, n - i, lo, hi);
+}
+
+CONVERT_TARGET("sse2") inline void minMaxSse2(const int8_t* src, size_t n, int8_t& lo, int8_t& hi) {
+	size_t i = 0;
+	if (n >= 16) {
+		const __m128i flip = _mm_set1_epi8(-128);
+		__m128i vlo = _mm_xor_si128(_mm_set1_epi8(lo), flip), vhi = _mm_xor_si128(_mm_set1_epi8(hi), flip);
+		for (; i + 16 <= n; i += 16) {
+			__m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), flip);
+			vlo = _mm_min_epu8(vlo, v);
+			vhi = _mm_max_epu8(vhi, v);
+		}
+		alignas(16) int8_t l[16], h[16];
+		_mm_store_si128(reinterpret_cast<__m128i*>(l), _mm_xor_si128(vlo, flip));
+		_mm_store_si128(reinterpret_cast<__m128i*>(h), _mm_xor_si128(vhi, flip));
+		minMaxScalar(l, 16, lo, hi);
+		minMaxScalar(h, 16, lo, hi);
+	}
+	minMaxScalar(src + i, n - i, lo, hi);
+}
+
+CONVERT_TARGET("avx2") inline void minMaxAvx2(const int16_t* src, size_t n, int16_t& lo, int16_t& hi) {
+	size_t i = 0;
+	if (n >= 16) {
+		__m256i vlo = _mm256_set1_epi16(lo), vhi = _mm256_set1_epi16(hi);
+		for (; i + 16 <= n; i += 16) {
+			__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+			vlo = _mm256_min_epi16(vlo, v);
+			vhi = _mm256_max_epi16(vhi, v);
+		}
+		alignas(32) int16_t l[16], h[16];
+		_mm256_store_si256(reinterpret_cast<__m256i*>(l), vlo);
+		_mm256_store_si256(reinterpret_cast<__m256i*>(h), vhi);
+		minMaxScalar(l, 16, lo, hi);
+		minMaxScalar(h, 16, lo, hi);
+	}
+	minMaxScalar(src + i, n - i, lo, hi);
+}
+
+CONVERT_TARGET("avx2") inline void minMaxAvx2(const int8_t* src, size_t n, int8_t& lo, int8_t& hi) {
+	size_t i = 0;
+	if (n >= 32) {
+		__m256i vlo = _mm256_set1_epi8(lo), vhi = _mm256_set1_epi8(hi);
+		for (; i + 32 <= n; i += 32) {
+			__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+			vlo = _mm256_min_epi8(vlo, v);
+			vhi = _mm256_max_epi8(vhi, v);
+		}
+		alignas(32) int8_t l[32], h[32];
+		_mm256_store_si256(reinterpret_cast<__m256i*>(l), vlo);
+		_mm256_store_si256(reinterpret_cast<__m256i*>(h), vhi);
+		minMaxScalar(l, 32, lo, hi);
+		minMaxScalar(h, 32, lo, hi);
+	}
+	minMaxScalar(src + i, n - i, lo, hi);
+}
+
+// AVX2 + FMA: 8 triangle areas per step in float, the running best kept per lane
+CONVERT_TARGET("avx2,fma") inline __m256 avx2Load8(const int8_t* src) {
+	return _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src))));
+}
+
+CONVERT_TARGET("avx2,fma") inline __m256 avx2Load8(const int16_t* src) {
+	return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src))));
+}
+
+template<typename Sample>
+CONVERT_TARGET("avx2,fma") size_t argMaxAreaAvx2(const Sample* src, size_t n, float alpha, float beta, float gamma) {
+	if (n < 16) return argMaxAreaScalar(src, n, alpha, beta, gamma);
+	const __m256 va = _mm256_set1_ps(alpha), vb = _mm256_set1_ps(beta), vg = _mm256_set1_ps(gamma);
+	const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	__m256 index = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+	__m256 bestArea = _mm256_set1_ps(-1), bestIndex = _mm256_setzero_ps();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 area = _mm256_and_ps(_mm256_fmadd_ps(va, avx2Load8(src + i), _mm256_fmadd_ps(vb, index, vg)), absMask);
+		__m256 better = _mm256_cmp_ps(area, bestArea, _CMP_GT_OQ);
+		bestArea = _mm256_blendv_ps(bestArea, area, better);
+		bestIndex = _mm256_blendv_ps(bestIndex, index, better);
+		index = _mm256_add_ps(index, _mm256_set1_ps(8));
+	}
+	alignas(32) float areas[8], indices[8];
+	_mm256_store_ps(areas, bestArea);
+	_mm256_store_ps(indices, bestIndex);
+	size_t best = static_cast<size_t>(indices[0]);
+	float top = areas[0];
+	for (int lane = 1; lane < 8; lane++) {
+		size_t k = static_cast<size_t>(indices[lane]);
+		if (areas[lane] > top || (areas[lane] == top && k < best)) {
+			top = areas[lane];
+			best = k;
+		}
+	}
+	for (; i < n; i++) {
+		float area = std::fabs(alpha * src[i] + beta * static_cast<float>(i) + gamma);
+		if (area > top) {
+			top = area;
+			best = i;
+		}
+	}
+	return best;
+}
+
+#endif
+
+}
+
+// Lowest and highest of n samples
+template<typename Sample>
+inline void sampleMinMax(const Sample* src, size_t n, Sample& lo, Sample& hi, ConvertIsa isa = bestConvertIsa()) {
+	static_assert(sizeof(Sample) <= 2, "samples are 1 or 2 bytes wide");
+	using S = typename std::conditional<sizeof(Sample) == 1, int8_t, int16_t>::type;
+	const S* s = reinterpret_cast<const S*>(src);
+	S l = std::numeric_limits<S>::max(), h = std::numeric_limits<S>::min();
+	switch (isa) {
+#ifdef CONVERT_X86
+	case ConvertIsa::Avx512:
+	case ConvertIsa::Avx2: decimate_detail::minMaxAvx2(s, n, l, h); break;
+	case ConvertIsa::Sse2: decimate_detail::minMaxSse2(s, n, l, h); break;
+#endif
+	default: decimate_detail::minMaxScalar(s, n, l, h); break;
+	}
+	lo = static_cast<Sample>(l);
+	hi = static_cast<Sample>(h);
+}
+
+// Picks the indices of at most targetPoints samples of each record, the index buffer
+// is kept between records so the storage thread does not allocate per event
+class Decimator {
+public:
+	Decimator(DecimateMode mode = DecimateMode::MinMax, size_t targetPoints = 20000, ConvertIsa isa = bestConvertIsa())
+		: mode_(mode), targetPoints_(std::max<size_t>(targetPoints, 3)), isa_(isa) {}
+
+	DecimateMode mode() const { return mode_; }
+	size_t targetPoints() const { return targetPoints_; }
+
+	// indices of the kept points of the n samples, ascending
+	template<typename Sample>
+	const std::vector<uint32_t>& operator()(const Sample* src, size_t n) {
+		indices_.clear();
+		if (mode_ == DecimateMode::None || n <= targetPoints_) {
+			for (size_t i = 0; i < n; i++) indices_.push_back(static_cast<uint32_t>(i));
+		}
+		else if (mode_ == DecimateMode::MinMax) minMax(src, n);
+		else lttb(src, n);
+		return indices_;
+	}
+
+private:
+	// two points per bucket, the minimum and the maximum in the order they occur
+	template<typename Sample>
+	void minMax(const Sample* src, size_t n) {
+		size_t buckets = targetPoints_ / 2;
+		for (size_t b = 0; b < buckets; b++) {
+			size_t begin = b * n / buckets, end = (b + 1) * n / buckets;
+			Sample lo, hi;
+			sampleMinMax(src + begin, end - begin, lo, hi, isa_);
+			size_t iLo = std::find(src + begin, src + end, lo) - src;
+			size_t iHi = std::find(src + begin, src + end, hi) - src;
+			indices_.push_back(static_cast<uint32_t>(std::min(iLo, iHi)));
+			if (iLo != iHi) indices_.push_back(static_cast<uint32_t>(std::max(iLo, iHi)));
+		}
+	}
+
+	// first and last point kept, the points in between split into targetPoints - 2 buckets;
+	// each bucket keeps the point spanning the largest triangle with the previously kept
+	// point and the average of the next bucket
+	template<typename Sample>
+	void lttb(const Sample* src, size_t n) {
+		size_t buckets = targetPoints_ - 2;
+		double width = static_cast<double>(n - 2) / buckets;
+		size_t a = 0;
+		indices_.push_back(0);
+		for (size_t b = 0; b < buckets; b++) {
+			size_t begin = 1 + static_cast<size_t>(b * width), end = 1 + static_cast<size_t>((b + 1) * width);
+			size_t nextBegin = end, nextEnd = std::min(n, 1 + static_cast<size_t>((b + 2) * width));
+			if (b + 1 == buckets) nextBegin = n - 1, nextEnd = n;
+			int64_t sum = 0;
+			for (size_t i = nextBegin; i < nextEnd; i++) sum += src[i];
+			double cx = 0.5 * (nextBegin + nextEnd - 1), cy = static_cast<double>(sum) / (nextEnd - nextBegin);
+
+			//twice the area for point i: |(ax - cx) * (y - ay) - (ax - i) * (cy - ay)|, linear in y and i,
+			//i counted from the start of the bucket to keep float precision
+			double ax = static_cast<double>(a), ay = src[a];
+			float alpha = static_cast<float>(ax - cx);
+			float beta = static_cast<float>(cy - ay);
+			float gamma = static_cast<float>(-(ax - cx) * ay - (ax - begin) * (cy - ay));
+			size_t pick = begin + argMaxArea(src + begin, end - begin, alpha, beta, gamma);
+			indices_.push_back(static_cast<uint32_t>(pick));
+			a = pick;
+		}
+		indices_.push_back(static_cast<uint32_t>(n - 1));
+	}
+
+	template<typename Sample>
+	size_t argMaxArea(const Sample* src, size_t n, float alpha, float beta, float gamma) const {
+		using S = typename std::conditional<sizeof(Sample) == 1, int8_t, int16_t>::type;
+		const S* s = reinterpret_cast<const S*>(src);
+#ifdef CONVERT_X86
+		if (isa_ >= ConvertIsa::Avx2) return decimate_detail::argMaxAreaAvx2(s, n, alpha, beta, gamma);
+#endif
+		return decimate_detail::argMaxAreaScalar(s, n, alpha, beta, gamma);
+	}
+
+	DecimateMode mode_;
+	size_t targetPoints_;
+	ConvertIsa isa_;
+	std::vector<uint32_t> indices_;
+};
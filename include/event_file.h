@@ -0,0 +1,258 @@
+#pragma once
+
+// Binary run file: one header with the waveform preamble, raw int8/int16 samples of
+// all events appended back to back in large chunks, and an event index at the end.
+//
+//   [EventFileHeader][event 0 samples][event 1 samples]...[EventIndexEntry x nEvents]
+//
+// EventFileReader maps the file into memory and hands out zero-copy views of events.
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static const char eventFileMagic[8] = { 'M', 'S', 'O', '4', '4', 'E', 'V', 'T' };
+
+struct EventFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t sampleBytes;		//1 for int8 samples, 2 for int16
+	uint64_t recordLength;		//nominal number of points per event
+	uint64_t nEvents;			//filled in when the file is closed
+	uint64_t indexOffset;		//position of the event index, 0 if the file was not closed
+	double xinc, xzero, pt_off;	//x(i) = (i - pt_off) * xinc + xzero
+	double ymult, yzero, yoff;	//y(i) = (sample - yoff) * ymult + yzero
+	uint8_t reserved[40];
+};
+static_assert(sizeof(EventFileHeader) == 128, "EventFileHeader layout changed");
+
+struct EventIndexEntry {
+	uint64_t offset;			//byte offset of the first sample from the start of the file
+	uint64_t nSamples;
+};
+
+class EventFileWriter {
+public:
+	EventFileWriter() = default;
+	EventFileWriter(const EventFileWriter&) = delete;
+	EventFileWriter& operator=(const EventFileWriter&) = delete;
+	~EventFileWriter() { close(); }
+
+	// chunkSize is the amount of sample data collected in memory before each write
+	bool open(
+		const std::string& filename,
+		uint32_t sampleBytes,
+		uint64_t recordLength,
+		double xinc, double xzero, double pt_off,
+		double ymult, double yzero, double yoff,
+		size_t chunkSize = 8 << 20) {
+
+		close();
+		file_ = std::fopen(filename.c_str(), "wb");
+		if (file_ == nullptr) {
+			printf("Error creating %s\n", filename.c_str());
+			return false;
+		}
+		std::memset(&header_, 0, sizeof(header_));
+		std::memcpy(header_.magic, eventFileMagic, sizeof(header_.magic));
+		header_.version = 1;
+		header_.sampleBytes = sampleBytes;
+		header_.recordLength = recordLength;
+		header_.xinc = xinc;
+		header_.xzero = xzero;
+		header_.pt_off = pt_off;
+		header_.ymult = ymult;
+		header_.yzero = yzero;
+		header_.yoff = yoff;
+		std::fwrite(&header_, sizeof(header_), 1, file_);
+
+		position_ = sizeof(header_);
+		chunk_.clear();
+		chunk_.reserve(chunkSize);
+		index_.clear();
+		return true;
+	}
+
+	// Appends one event, samples are copied as they came from the scope
+	void append(const void* samples, size_t nSamples) {
+		size_t nBytes = nSamples * header_.sampleBytes;
+		index_.push_back({ position_ + chunk_.size(), nSamples });
+		if (chunk_.size() + nBytes > chunk_.capacity()) flush();
+		if (nBytes > chunk_.capacity()) {
+			std::fwrite(samples, 1, nBytes, file_);		//larger than a chunk, write directly
+			position_ += nBytes;
+		}
+		else {
+			const char* bytes = static_cast<const char*>(samples);
+			chunk_.insert(chunk_.end(), bytes, bytes + nBytes);
+		}
+	}
+
+	// Writes the index and the final header, the file is complete afterwards
+	void close() {
+		if (file_ == nullptr) return;
+		flush();
+		header_.nEvents = index_.size();
+		header_.indexOffset = position_;
+		std::fwrite(index_.data(), sizeof(EventIndexEntry), index_.size(), file_);
+		std::fseek(file_, 0, SEEK_SET);
+		std::fwrite(&header_, sizeof(header_), 1, file_);
+		std::fclose(file_);
+		file_ = nullptr;
+	}
+
+	size_t events() const { return index_.size(); }
+
+private:
+	void flush() {
+		if (chunk_.empty()) return;
+		std::fwrite(chunk_.data(), 1, chunk_.size(), file_);
+		position_ += chunk_.size();
+		chunk_.clear();
+	}
+
+	std::FILE* file_ = nullptr;
+	EventFileHeader header_;
+	uint64_t position_ = 0;
+	std::vector<char> chunk_;
+	std::vector<EventIndexEntry> index_;
+};
+
+// Samples of one event inside a mapped run file, no data is copied
+template<typename T>
+struct WaveformView {
+	const T* samples;
+	size_t nSamples;
+
+	size_t size() const { return nSamples; }
+	const T& operator[](size_t i) const { return samples[i]; }
+	const T* begin() const { return samples; }
+	const T* end() const { return samples + nSamples; }
+};
+
+class EventFileReader {
+public:
+	EventFileReader() = default;
+	EventFileReader(const EventFileReader&) = delete;
+	EventFileReader& operator=(const EventFileReader&) = delete;
+	~EventFileReader() { close(); }
+
+	bool open(const std::string& filename) {
+		close();
+		if (!map(filename)) {
+			printf("Error mapping %s\n", filename.c_str());
+			return false;
+		}
+		if (size_ < sizeof(EventFileHeader) || std::memcmp(header().magic, eventFileMagic, sizeof(eventFileMagic)) != 0) {
+			printf("%s is not an event file\n", filename.c_str());
+			close();
+			return false;
+		}
+		const EventFileHeader& h = header();
+		if (h.indexOffset != 0 && h.indexOffset + h.nEvents * sizeof(EventIndexEntry) <= size_) {
+			index_ = reinterpret_cast<const EventIndexEntry*>(data_ + h.indexOffset);
+			nEvents_ = h.nEvents;
+		}
+		else {
+			//file was not closed, events have the nominal record length
+			fallbackIndex_.clear();
+			uint64_t eventBytes = h.recordLength * h.sampleBytes;
+			for (uint64_t pos = sizeof(EventFileHeader); eventBytes > 0 && pos + eventBytes <= size_; pos += eventBytes) {
+				fallbackIndex_.push_back({ pos, h.recordLength });
+			}
+			index_ = fallbackIndex_.data();
+			nEvents_ = fallbackIndex_.size();
+		}
+		return true;
+	}
+
+	void close() {
+		if (data_ != nullptr) unmap();
+		data_ = nullptr;
+		size_ = 0;
+		index_ = nullptr;
+		nEvents_ = 0;
+	}
+
+	const EventFileHeader& header() const { return *reinterpret_cast<const EventFileHeader*>(data_); }
+	size_t events() const { return nEvents_; }
+
+	// T must match header().sampleBytes: int8_t for 1 byte samples, int16_t for 2
+	template<typename T>
+	WaveformView<T> event(size_t i) const {
+		return { reinterpret_cast<const T*>(data_ + index_[i].offset), static_cast<size_t>(index_[i].nSamples) };
+	}
+
+	double time(size_t point) const {
+		const EventFileHeader& h = header();
+		return (static_cast<double>(point) - h.pt_off) * h.xinc + h.xzero;
+	}
+
+	double volts(double sample) const {
+		const EventFileHeader& h = header();
+		return (sample - h.yoff) * h.ymult + h.yzero;
+	}
+
+private:
+#ifdef _WIN32
+	bool map(const std::string& filename) {
+		file_ = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file_ == INVALID_HANDLE_VALUE) return false;
+		LARGE_INTEGER size;
+		GetFileSizeEx(file_, &size);
+		size_ = static_cast<size_t>(size.QuadPart);
+		mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping_ == nullptr) {
+			CloseHandle(file_);
+			return false;
+		}
+		data_ = static_cast<const char*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+		return data_ != nullptr;
+	}
+
+	void unmap() {
+		UnmapViewOfFile(data_);
+		CloseHandle(mapping_);
+		CloseHandle(file_);
+	}
+
+	HANDLE file_ = INVALID_HANDLE_VALUE;
+	HANDLE mapping_ = nullptr;
+#else
+	bool map(const std::string& filename) {
+		int fd = ::open(filename.c_str(), O_RDONLY);
+		if (fd < 0) return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0) {
+			::close(fd);
+			return false;
+		}
+		size_ = static_cast<size_t>(st.st_size);
+		void* p = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);					//the mapping keeps the file open
+		if (p == MAP_FAILED) return false;
+		madvise(p, size_, MADV_SEQUENTIAL);
+		data_ = static_cast<const char*>(p);
+		return true;
+	}
+
+	void unmap() { munmap(const_cast<char*>(data_), size_); }
+#endif
+
+	const char* data_ = nullptr;
+	size_t size_ = 0;
+	const EventIndexEntry* index_ = nullptr;
+	size_t nEvents_ = 0;
+	std::vector<EventIndexEntry> fallbackIndex_;
+};
@@ -0,0 +1,213 @@
+#pragma once
+
+// Trigger timing of a run: host steady_clock stamps when the scope is armed, when the
+// trigger is seen and when the readout completes, plus the scope's own trigger
+// timestamps of FastFrame frames (horizontal:fastframe:timestamp:all?) and its
+// acquisition counter (acquire:numacq?). RunTiming turns them into live time, dead-time
+// fraction and average/instantaneous trigger rates for rate normalization.
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <string_view>
+
+#include "visa.h"
+#include "visatype.h"
+#include "vi_c2cpp.h"
+#include "latency.h"
+#include "raw_transfer.h"
+
+inline int64_t daysFromCivil(int64_t y, int m, int d) {
+	y -= m <= 2;
+	int64_t era = (y >= 0 ? y : y - 399) / 400;
+	int64_t yoe = y - era * 400;
+	int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+}
+
+// "02 Mar 2000 20:10:54.542 037 272 620" to ns on the scope's clock, digits past the
+// nanosecond are dropped; only differences between timestamps are used
+inline bool ParseScopeTimestamp(std::string_view text, int64_t& ns) {
+	static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	const char* p = text.data();
+	const char* end = p + text.size();
+	auto skipSpaces = [&]() { while (p < end && *p == ' ') p++; };
+	auto number = [&](int64_t& v) {
+		auto r = std::from_chars(p, end, v);
+		if (r.ec != std::errc()) return false;
+		p = r.ptr;
+		return true;
+	};
+
+	int64_t day, year, hour, minute, second;
+	skipSpaces();
+	if (!number(day)) return false;
+	skipSpaces();
+	if (end - p < 3) return false;
+	std::string_view month(p, 3), names(months);
+	size_t m = names.find(month);
+	if (m == std::string_view::npos || m % 3 != 0) return false;
+	p += 3;
+	skipSpaces();
+	if (!number(year)) return false;
+	skipSpaces();
+	if (!number(hour) || p == end || *p++ != ':' || !number(minute) || p == end || *p++ != ':' || !number(second)) return false;
+
+	int64_t fraction = 0;
+	int digits = 0;
+	if (p < end && *p == '.') p++;
+	for (; p < end; p++) {
+		if (*p == ' ') continue;
+		if (*p < '0' || *p > '9') break;
+		if (digits < 9) {
+			fraction = fraction * 10 + (*p - '0');
+			digits++;
+		}
+	}
+	for (; digits < 9; digits++) fraction *= 10;
+
+	int64_t days = daysFromCivil(year, static_cast<int>(m / 3) + 1, static_cast<int>(day));
+	ns = ((days * 24 + hour) * 60 + minute) * 60 + second;
+	ns = ns * 1000000000 + fraction;
+	return true;
+}
+
+// Reads the trigger timestamps of the frames of the last FastFrame sequence into ns,
+// the reply is parsed while it streams in so any number of frames fits.
+// Returns 0 if all nFrames were read, 9 otherwise.
+inline int ReadFrameTimestamps(const ViSession& instr, size_t nFrames, int64_t* ns, ViUInt32& retCount) {
+	LatencyTimer timer(LatencyStage::Query);
+	if (instrWrite(instr, scpi::frameTimestamps, retCount) != 0) return 9;
+
+	char chunk[4096], field[64];
+	size_t fieldLength = 0, n = 0;
+	bool quoted = false, valid = true;
+	ViStatus status;
+	do {
+		status = transportRead(instr, reinterpret_cast<ViUInt8*>(chunk), sizeof(chunk), &retCount);
+		if (status < VI_SUCCESS) break;
+		for (ViUInt32 i = 0; i < retCount; i++) {
+			char c = chunk[i];
+			if (c != '"') {
+				if (quoted && fieldLength < sizeof(field)) field[fieldLength++] = c;
+				continue;
+			}
+			quoted = !quoted;
+			if (quoted) fieldLength = 0;
+			else if (n < nFrames) valid = ParseScopeTimestamp(std::string_view(field, fieldLength), ns[n++]) && valid;
+		}
+	} while (status == VI_SUCCESS_MAX_CNT);
+
+	if (status < VI_SUCCESS || !valid || n < nFrames) {
+		printf("Error reading frame timestamps\n");
+		return 9;
+	}
+	return 0;
+}
+
+// acquisitions counted by the scope since acquire:state run, triggers it saw whether
+// they were read out or not
+inline int QueryAcquisitionCount(const ViSession& instr, uint64_t& count, ViUInt32& retCount, ViChar* buffer) {
+	instrQuery(instr, scpi::acquisitionCount, retCount, buffer);
+	const char* end = buffer + retCount;
+	if (std::from_chars(buffer, end, count).ec != std::errc()) {
+		printf("Error reading acquisition count\n");
+		return 9;
+	}
+	return 0;
+}
+
+// Accounting of one run, fed by the readout thread after each transfer.
+// Live time is the time the scope was armed and waiting for a trigger, everything else
+// (transfer, re-arm, queries) is dead time. Instantaneous rates come from the intervals
+// between consecutive scope timestamps, or between host trigger stamps without them.
+class RunTiming {
+public:
+	using Clock = TransferTiming::Clock;
+
+	void start() {
+		start_ = last_ = Clock::now();
+		live_ = Clock::duration::zero();
+		events_ = 0;
+		intervals_.reset();
+		scopeStamped_ = false;
+		scopeBase_ = lastScope_ = 0;
+		haveTrigger_ = false;
+		scopeAcquisitions_ = 0;
+	}
+
+	// scopeNs holds the scope timestamps of the nFrames frames, or is null
+	void record(const TransferTiming& t, size_t nFrames, const int64_t* scopeNs = nullptr) {
+		if (t.triggered > t.armed) live_ += t.triggered - t.armed;
+		last_ = t.readout;
+		events_ += nFrames;
+		if (scopeNs != nullptr) {
+			for (size_t k = 0; k < nFrames; k++) {
+				if (!scopeStamped_) scopeBase_ = scopeNs[k];
+				else if (scopeNs[k] > lastScope_) intervals_.record(static_cast<uint64_t>(scopeNs[k] - lastScope_));
+				lastScope_ = scopeNs[k];
+				scopeStamped_ = true;
+			}
+		}
+		else if (nFrames == 1) {
+			if (haveTrigger_) intervals_.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(t.triggered - lastTrigger_).count()));
+			lastTrigger_ = t.triggered;
+			haveTrigger_ = true;
+		}
+	}
+
+	// acquire:numacq? difference over the run, 0 if unknown
+	void setScopeAcquisitions(uint64_t n) { scopeAcquisitions_ = n; }
+
+	// seconds since start() and since the first scope timestamp, for per-event records
+	double hostSeconds(Clock::time_point t) const { return std::chrono::duration<double>(t - start_).count(); }
+	double scopeSeconds(int64_t ns) const { return (ns - scopeBase_) * 1e-9; }
+
+	size_t events() const { return events_; }
+	double elapsed() const { return std::chrono::duration<double>(last_ - start_).count(); }
+	double liveTime() const { return std::chrono::duration<double>(live_).count(); }
+	double deadFraction() const { return elapsed() > 0 ? 1.0 - liveTime() / elapsed() : 0.0; }
+
+	void print(std::ostream& os) const {
+		char line[200];
+		double elapsedTime = elapsed(), live = liveTime();
+		std::snprintf(line, sizeof(line), "live time:       %.3f s of %.3f s, dead time %.1f %%\n", live, elapsedTime, 100.0 * deadFraction());
+		os << line;
+		std::snprintf(line, sizeof(line), "trigger rate:    %.2f /s recorded, %.2f /s per live second\n",
+			elapsedTime > 0 ? events_ / elapsedTime : 0.0, live > 0 ? events_ / live : 0.0);
+		os << line;
+		if (intervals_.count() > 0) {
+			// short intervals are high rates, p90 of the rate is p10 of the interval
+			std::snprintf(line, sizeof(line), "instantaneous:   p10 %.2f, p50 %.2f, p90 %.2f /s from %llu %s intervals\n",
+				rate(intervals_.percentile(0.9)), rate(intervals_.percentile(0.5)), rate(intervals_.percentile(0.1)),
+				static_cast<unsigned long long>(intervals_.count()), scopeStamped_ ? "scope timestamp" : "host trigger");
+			os << line;
+		}
+		// free-running, the scope keeps triggering during readout: its own count is the true
+		// trigger rate and the recorded fraction the live fraction of the recording; the
+		// waveform pending at start() was counted before the run, hence the clamp
+		if (scopeAcquisitions_ > 0) {
+			std::snprintf(line, sizeof(line), "scope triggers:  %llu acquisitions, %.2f /s, %.1f %% recorded\n",
+				static_cast<unsigned long long>(scopeAcquisitions_), elapsedTime > 0 ? scopeAcquisitions_ / elapsedTime : 0.0,
+				100.0 * std::min<uint64_t>(events_, scopeAcquisitions_) / scopeAcquisitions_);
+			os << line;
+		}
+	}
+
+private:
+	static double rate(uint64_t intervalNs) { return intervalNs > 0 ? 1e9 / intervalNs : std::numeric_limits<double>::infinity(); }
+
+	Clock::time_point start_, last_, lastTrigger_;
+	Clock::duration live_ = Clock::duration::zero();
+	size_t events_ = 0;
+	LatencyHistogram intervals_;
+	bool scopeStamped_ = false, haveTrigger_ = false;
+	int64_t scopeBase_ = 0, lastScope_ = 0;
+	uint64_t scopeAcquisitions_ = 0;
+};
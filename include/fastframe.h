@@ -0,0 +1,76 @@
+#pragma once
+
+// FastFrame (segmented memory) acquisition: the scope captures a number of
+// triggers into segmented memory and all frames are read back with a single
+// curve? query, instead of one network round trip per event.
+
+#include <vector>
+
+#include "visa.h"
+#include "visatype.h"
+#include "vi_c2cpp.h"
+#include "raw_transfer.h"
+#include "ieee_block.h"
+
+// Switches the scope to single-sequence acquisition of nFrames FastFrame frames
+inline int SetupFastFrame(const ViSession& instr, size_t nFrames, ViUInt32& retCount) {
+	ScpiBatch batch;
+	batch.add("horizontal:fastframe:state on");
+	batch.add(ScpiCommand<>("horizontal:fastframe:count ").add(nFrames));
+	batch.add("data:framestart 1");									//transfer all frames at once
+	batch.add(ScpiCommand<>("data:framestop ").add(nFrames));
+	batch.add("acquire:stopafter sequence");
+	return batch.flush(instr, retCount);
+}
+
+// Returns the scope to continuous single-frame acquisition
+inline void DisableFastFrame(const ViSession& instr, ViUInt32& retCount) {
+	ScpiBatch batch;
+	batch.add("horizontal:fastframe:state off").add("acquire:stopafter runstop").add("acquire:state run");
+	batch.flush(instr, retCount);
+}
+
+// Arms one sequence, waits until all frames are captured and reads them in one transfer
+// into block.buffer, which must hold recordLength * nFrames samples; frames are stored back to back.
+// VISA timeout must cover the time needed to collect nFrames triggers.
+template<typename Sample>
+int AcquireFastFrame(
+	const ViSession& instr,
+	size_t recordLength,
+	size_t nFrames,
+	RawTransfer<Sample>& block,
+	ViUInt32& retCount,
+	ViChar* buffer) {
+
+	//start the sequence, *opc? returns when it is complete
+	LatencyTimer triggerWait(LatencyStage::TriggerWait);
+	block.timing.armed = TransferTiming::Clock::now();
+	instrQuery(instr, scpi::acquireAndWait, retCount, buffer);
+	block.timing.triggered = TransferTiming::Clock::now();
+	triggerWait.stop();
+
+	size_t nBytes = recordLength * nFrames * sizeof(Sample);
+	size_t received = 0;
+	block.recordLength = recordLength;
+	block.nFrames = 0;
+	if (block.buffer == nullptr || block.buffer->capacity * sizeof(Sample) < nBytes) {
+		printf("FastFrame buffer too small for %zu bytes\n", nBytes);
+		return 3;
+	}
+
+	LatencyTimer transfer(LatencyStage::Curve);
+	instrWrite(instr, scpi::curve, retCount);
+	if (ReadIeeeBlock(instr, block.buffer->data, block.buffer->capacity * sizeof(Sample), received, retCount) != 0) {
+		printf("Error reading FastFrame data\n");
+		return 3;
+	}
+	transfer.stop();
+	block.timing.readout = TransferTiming::Clock::now();
+	block.buffer->size = received / sizeof(Sample);
+	if (received < nBytes) {
+		printf("Short FastFrame transfer: %zu of %zu bytes\n", received, nBytes);
+		return 3;
+	}
+	block.nFrames = nFrames;
+	return 0;
+}
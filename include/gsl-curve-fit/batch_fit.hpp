@@ -0,0 +1,176 @@
+#pragma once
+
+#include "curve_fit.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Batched fitting: many waveforms sampled at the same x are fitted with the same
+// model, spread over a pool of worker threads. Each worker keeps its own gsl
+// workspace, so no allocation happens per fit once the pool is warm. Generic models
+// get their derivatives by automatic differentiation, as with curve_fitter.
+
+
+/**
+ * Parameter matrix of a batch fit, one row of n_params coefficients per waveform.
+ */
+struct batch_fit_result
+{
+    std::vector<double> params;
+    size_t n_params = 0;
+    // gsl status of each fit, GSL_SUCCESS when the solver converged
+    std::vector<int> status;
+
+    auto size() const -> size_t { return status.size(); }
+    auto row(size_t i) const -> const double* { return params.data() + i * n_params; }
+};
+
+
+class batch_fitter
+{
+public:
+    /**
+     * Starts n_threads workers, they sleep until a batch is submitted.
+     */
+    explicit batch_fitter(size_t n_threads = std::thread::hardware_concurrency())
+    {
+        if(n_threads == 0) n_threads = 1;
+        workspaces.resize(n_threads);
+        for(size_t i = 0; i < n_threads; i++)
+        {
+            threads.emplace_back([this, i]{ worker(i); });
+        }
+    }
+
+    batch_fitter(const batch_fitter&) = delete;
+    auto operator=(const batch_fitter&) -> batch_fitter& = delete;
+
+    ~batch_fitter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        start.notify_all();
+        for(auto& t: threads) t.join();
+    }
+
+    auto n_threads() const -> size_t { return threads.size(); }
+
+    /**
+     * Fits f to n_fits waveforms and blocks until all of them are done.
+     *
+     * @param f a function of type double (double x, double c1, double c2, ..., double cn),
+     * or a generic lambda as in curve_fit_autodiff.
+     * @param initial_params intial guess, the same for every waveform.
+     * @param x the independent data, shared by all waveforms.
+     * @param ys n_fits * x.size() values, waveform k starts at ys + k * x.size().
+     * @return the fitted coefficients of waveform k in row k.
+     */
+    template<typename Callable>
+    auto fit(Callable f, const std::vector<double>& initial_params, const std::vector<double>& x,
+             const double* ys, size_t n_fits) -> batch_fit_result
+    {
+        constexpr auto n = model_arity<Callable>();
+        assert(initial_params.size() == n);
+
+        auto result = batch_fit_result();
+        result.n_params = n;
+        result.params.resize(n_fits * n);
+        result.status.resize(n_fits);
+
+        auto guess = gsl_vector_const_view_array(initial_params.data(), n);
+        const auto points = x.size();
+
+        run(n_fits, points, n, [&](size_t k, gsl_multifit_nlinear_workspace* work)
+        {
+            auto fd = fit_data<Callable>{x.data(), ys + k * points, points, f};
+            auto fdf = internal_make_model_fdf<n>(fd);
+            result.status[k] = internal_solve_system(&guess.vector, &fdf, work, result.params.data() + k * n);
+        });
+        return result;
+    }
+
+    /**
+     * Same as above with one vector per waveform, all of them of size x.size().
+     */
+    template<typename Callable>
+    auto fit(Callable f, const std::vector<double>& initial_params, const std::vector<double>& x,
+             const std::vector<std::vector<double>>& ys) -> batch_fit_result
+    {
+        constexpr auto n = model_arity<Callable>();
+        assert(initial_params.size() == n);
+
+        auto result = batch_fit_result();
+        result.n_params = n;
+        result.params.resize(ys.size() * n);
+        result.status.resize(ys.size());
+
+        auto guess = gsl_vector_const_view_array(initial_params.data(), n);
+        const auto points = x.size();
+
+        run(ys.size(), points, n, [&](size_t k, gsl_multifit_nlinear_workspace* work)
+        {
+            assert(ys[k].size() == points);
+            auto fd = fit_data<Callable>{x.data(), ys[k].data(), points, f};
+            auto fdf = internal_make_model_fdf<n>(fd);
+            result.status[k] = internal_solve_system(&guess.vector, &fdf, work, result.params.data() + k * n);
+        });
+        return result;
+    }
+
+private:
+    template<typename Job>
+    void run(size_t n_fits, size_t points, size_t n_params, const Job& job)
+    {
+        if(n_fits == 0) return;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        task = [&](size_t thread)
+        {
+            auto* work = workspaces[thread].get(points, n_params);
+            for(size_t k = next.fetch_add(1); k < n_fits; k = next.fetch_add(1))
+            {
+                job(k, work);
+            }
+        };
+        next = 0;
+        busy = threads.size();
+        generation++;
+        start.notify_all();
+        done.wait(lock, [this]{ return busy == 0; });
+        task = nullptr;
+    }
+
+    void worker(size_t thread)
+    {
+        size_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while(true)
+        {
+            start.wait(lock, [&]{ return stopping || generation != seen; });
+            if(stopping) return;
+            seen = generation;
+
+            lock.unlock();
+            task(thread);
+            lock.lock();
+
+            if(--busy == 0) done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> threads;
+    std::vector<fit_workspace> workspaces;
+
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable done;
+    std::function<void (size_t)> task;
+    std::atomic<size_t> next{0};
+    size_t busy = 0;
+    size_t generation = 0;
+    bool stopping = false;
+};
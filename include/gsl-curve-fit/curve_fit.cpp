@@ -1,32 +1,46 @@
 #include "curve_fit.hpp"
 
 
-auto internal_solve_system(gsl_vector* initial_params, gsl_multifit_nlinear_fdf *fdf,
-             gsl_multifit_nlinear_parameters *params) -> std::vector<double>
+auto internal_default_parameters() -> gsl_multifit_nlinear_parameters
+{
+  auto fdf_params = gsl_multifit_nlinear_default_parameters();
+  // "This selects the Levenberg-Marquardt algorithm with geodesic acceleration."
+  fdf_params.trs = gsl_multifit_nlinear_trs_lmaccel;
+  return fdf_params;
+}
+
+auto internal_solve_system(const gsl_vector* initial_params, gsl_multifit_nlinear_fdf *fdf,
+             gsl_multifit_nlinear_workspace* work, double* result) -> int
 {
-  // This specifies a trust region method
-  const gsl_multifit_nlinear_type *T = gsl_multifit_nlinear_trust;
   const size_t max_iter = 200;
   const double xtol = 1.0e-8;
   const double gtol = 1.0e-8;
   const double ftol = 1.0e-8;
-
-  auto *work = gsl_multifit_nlinear_alloc(T, params, fdf->n, fdf->p);
   int info;
 
   // initialize solver
   gsl_multifit_nlinear_init(initial_params, fdf, work);
   //iterate until convergence
-  gsl_multifit_nlinear_driver(max_iter, xtol, gtol, ftol, nullptr, nullptr, &info, work);
+  int status = gsl_multifit_nlinear_driver(max_iter, xtol, gtol, ftol, nullptr, nullptr, &info, work);
 
   // result will be stored here
   gsl_vector * y    = gsl_multifit_nlinear_position(work);
-  auto result = std::vector<double>(initial_params->size);
-
-  for(int i = 0; i < result.size(); i++)
+  for(size_t i = 0; i < fdf->p; i++)
   {
     result[i] = gsl_vector_get(y, i);
   }
+  return status;
+}
+
+auto internal_solve_system(gsl_vector* initial_params, gsl_multifit_nlinear_fdf *fdf,
+             gsl_multifit_nlinear_parameters *params) -> std::vector<double>
+{
+  // This specifies a trust region method
+  const gsl_multifit_nlinear_type *T = gsl_multifit_nlinear_trust;
+
+  auto *work = gsl_multifit_nlinear_alloc(T, params, fdf->n, fdf->p);
+  auto result = std::vector<double>(initial_params->size);
+  internal_solve_system(initial_params, fdf, work, result.data());
 
   auto niter = gsl_multifit_nlinear_niter(work);
   auto nfev  = fdf->nevalf;
@@ -6,6 +6,9 @@
 #include <vector>
 #include <cassert>
 #include <functional>
+#include <type_traits>
+
+#include "dual.hpp"
 
 // For information about non-linear least-squares fit with gsl
 // see https://www.gnu.org/software/gsl/doc/html/nls.html
@@ -47,15 +50,78 @@ auto gen_tuple(F func)
     return gen_tuple_impl(func, std::make_index_sequence<N>{} );
 }
 
+/**
+ * The number of coefficients of a model callable as f(x, c1, ..., cn), found by
+ * trying n = 0, 1, ... This also works for generic lambdas, where n_params doesn't.
+ */
+template <typename F, size_t... Is>
+constexpr auto internal_invocable(std::index_sequence<Is...>) -> bool
+{
+    return std::is_invocable_v<F, double, decltype((void)Is, 0.0)...>;
+}
+
+/**
+ * A vector model evaluates all points in one call, which lets the compiler vectorize
+ * the loop over t:
+ *
+ *     struct model
+ *     {
+ *         static constexpr size_t n_params = 2;
+ *         // y[i] = f(t[i], c[0], c[1]) for i < n
+ *         void operator()(const double* t, size_t n, const double* c, double* y) const;
+ *         // optional, J[i * n_params + j] = df/dcj at t[i]
+ *         void jacobian(const double* t, size_t n, const double* c, double* J) const;
+ *     };
+ */
+template <typename M, typename = void>
+struct is_vector_model : std::false_type {};
+
+template <typename M>
+struct is_vector_model<M, std::void_t<decltype(M::n_params),
+    decltype(std::declval<const M&>()(std::declval<const double*>(), size_t(), std::declval<const double*>(), std::declval<double*>()))>>
+    : std::true_type {};
+
+template <typename M, typename = void>
+struct has_vector_jacobian : std::false_type {};
+
+template <typename M>
+struct has_vector_jacobian<M, std::void_t<
+    decltype(std::declval<const M&>().jacobian(std::declval<const double*>(), size_t(), std::declval<const double*>(), std::declval<double*>()))>>
+    : std::true_type {};
+
+template <typename F, size_t N = 0>
+constexpr auto model_arity() -> size_t
+{
+    if constexpr (is_vector_model<F>::value)
+        return F::n_params;
+    else
+    {
+        static_assert(N <= 16, "the model must be callable as f(x, c1, ..., cn) with n <= 16");
+        if constexpr (internal_invocable<F>(std::make_index_sequence<N>{}))
+            return N;
+        else
+            return model_arity<F, N + 1>();
+    }
+}
+
 template<typename C1>
 struct fit_data
 {
-    const std::vector<double>& t;
-    const std::vector<double>& y;
+    // n data points, the arrays are not copied
+    const double* t;
+    const double* y;
+    size_t n;
     // the actual function to be fitted
     C1 f;
 };
 
+template<typename C1, typename C2>
+struct fit_data_df : fit_data<C1>
+{
+    // gradient of f with respect to the coefficients, df(x, c1, ..., cn)[j] = df/dcj
+    C2 df;
+};
+
 
 template<typename FitData, int n_params>
 int internal_f(const gsl_vector* x, void* params, gsl_vector *f)
@@ -69,7 +135,9 @@ int internal_f(const gsl_vector* x, void* params, gsl_vector *f)
     auto parameters = gen_tuple<n_params>(init_args);
 
     // Calculate the error for each...
-    for (size_t i = 0; i < d->t.size(); ++i)
+    double* r = f->data;
+    const size_t stride = f->stride;
+    for (size_t i = 0; i < d->n; ++i)
     {
         double ti = d->t[i];
         double yi = d->y[i];
@@ -79,7 +147,149 @@ int internal_f(const gsl_vector* x, void* params, gsl_vector *f)
             return d->f(ti, xs...);
         };
         auto y = std::apply(func, parameters);
-        gsl_vector_set(f, i, yi - y);
+        r[i * stride] = yi - y;
+    }
+    return GSL_SUCCESS;
+}
+
+/**
+ * Residuals of a vector model: the model writes all n values straight into f, which
+ * are then turned into y - f in the same contiguous array.
+ */
+template<typename FitData, int n_params>
+int internal_f_vector(const gsl_vector* x, void* params, gsl_vector *f)
+{
+    auto* d  = static_cast<FitData*>(params);
+    assert(f->stride == 1);
+    double c[n_params];
+    for (size_t j = 0; j < n_params; ++j)
+    {
+        c[j] = gsl_vector_get(x, j);
+    }
+
+    double* r = f->data;
+    const double* y = d->y;
+    d->f(d->t, d->n, c, r);
+    for (size_t i = 0; i < d->n; ++i)
+    {
+        r[i] = y[i] - r[i];
+    }
+    return GSL_SUCCESS;
+}
+
+/**
+ * Jacobian of the residuals from the jacobian() of a vector model, written row-major
+ * into J and negated since the residuals are y - f.
+ */
+template<typename FitData, int n_params>
+int internal_df_vector(const gsl_vector* x, void* params, gsl_matrix* J)
+{
+    auto* d  = static_cast<FitData*>(params);
+    assert(J->tda == n_params);
+    double c[n_params];
+    for (size_t j = 0; j < n_params; ++j)
+    {
+        c[j] = gsl_vector_get(x, j);
+    }
+
+    double* jac = J->data;
+    d->f.jacobian(d->t, d->n, c, jac);
+    for (size_t k = 0; k < d->n * n_params; ++k)
+    {
+        jac[k] = -jac[k];
+    }
+    return GSL_SUCCESS;
+}
+
+/**
+ * Jacobian of the residuals from the user supplied gradient of f. The residuals are
+ * y - f, so J(i, j) = -df/dcj at t[i].
+ */
+template<typename FitData, int n_params>
+int internal_df(const gsl_vector* x, void* params, gsl_matrix* J)
+{
+    auto* d  = static_cast<FitData*>(params);
+    auto init_args = [x](int index)
+    {
+        return gsl_vector_get(x, index);
+    };
+    auto parameters = gen_tuple<n_params>(init_args);
+
+    for (size_t i = 0; i < d->n; ++i)
+    {
+        double ti = d->t[i];
+        auto func = [ti, &d](auto ...xs)
+        {
+            return d->df(ti, xs...);
+        };
+        auto gradient = std::apply(func, parameters);
+        for (size_t j = 0; j < n_params; ++j)
+        {
+            gsl_matrix_set(J, i, j, -gradient[j]);
+        }
+    }
+    return GSL_SUCCESS;
+}
+
+/**
+ * Jacobian of the residuals by forward-mode automatic differentiation: the model is
+ * evaluated once per point with dual numbers carrying all n_params partial derivatives.
+ */
+template<typename FitData, int n_params>
+int internal_df_autodiff(const gsl_vector* x, void* params, gsl_matrix* J)
+{
+    using number = autodiff::dual<double, n_params>;
+    auto* d  = static_cast<FitData*>(params);
+    auto init_args = [x](int index)
+    {
+        return number::variable(gsl_vector_get(x, index), index);
+    };
+    auto parameters = gen_tuple<n_params>(init_args);
+
+    for (size_t i = 0; i < d->n; ++i)
+    {
+        double ti = d->t[i];
+        auto func = [ti, &d](auto ...xs)
+        {
+            return number(d->f(ti, xs...));
+        };
+        auto y = std::apply(func, parameters);
+        for (size_t j = 0; j < n_params; ++j)
+        {
+            gsl_matrix_set(J, i, j, -y.d[j]);
+        }
+    }
+    return GSL_SUCCESS;
+}
+
+/**
+ * Second directional derivative of the residuals along v, needed by the geodesic
+ * acceleration: fvv[i] = sum_jk v_j v_k d2r_i/dc_j dc_k. The model is evaluated with
+ * nested dual numbers seeded with v, whose mixed part is exactly that sum.
+ */
+template<typename FitData, int n_params>
+int internal_fvv_autodiff(const gsl_vector* x, const gsl_vector* v, void* params, gsl_vector* fvv)
+{
+    using inner  = autodiff::dual<double, 1>;
+    using number = autodiff::dual<inner, 1>;
+    auto* d  = static_cast<FitData*>(params);
+    auto init_args = [x, v](int index)
+    {
+        const double c  = gsl_vector_get(x, index);
+        const double vi = gsl_vector_get(v, index);
+        return number(inner(c, {vi}), {inner(vi, {0.0})});
+    };
+    auto parameters = gen_tuple<n_params>(init_args);
+
+    for (size_t i = 0; i < d->n; ++i)
+    {
+        double ti = d->t[i];
+        auto func = [ti, &d](auto ...xs)
+        {
+            return number(d->f(ti, xs...));
+        };
+        auto y = std::apply(func, parameters);
+        gsl_vector_set(fvv, i, -y.d[0].d[0]);
     }
     return GSL_SUCCESS;
 }
@@ -95,23 +305,37 @@ auto internal_make_gsl_vector_ptr(const std::vector<double>& vec) -> gsl_vector*
 auto internal_solve_system(gsl_vector* initial_params, gsl_multifit_nlinear_fdf *fdf,
              gsl_multifit_nlinear_parameters *params) -> std::vector<double>;
 
+/**
+ * Runs one fit in a workspace allocated by the caller, so it can be reused for many
+ * fits with the same number of points and parameters. The fitted parameters are
+ * written to result; returns the GSL status of the driver.
+ */
+auto internal_solve_system(const gsl_vector* initial_params, gsl_multifit_nlinear_fdf *fdf,
+             gsl_multifit_nlinear_workspace* work, double* result) -> int;
+
+/**
+ * Solver settings shared by all fits: Levenberg-Marquardt with geodesic acceleration.
+ */
+auto internal_default_parameters() -> gsl_multifit_nlinear_parameters;
+
 template<typename C1>
-auto curve_fit_impl(func_f_type f, func_df_type df, func_fvv_type fvv, gsl_vector* initial_params, fit_data<C1>& fd) -> std::vector<double>
+auto internal_make_fdf(func_f_type f, func_df_type df, func_fvv_type fvv, size_t n_params, fit_data<C1>& fd) -> gsl_multifit_nlinear_fdf
 {
-    assert(fd.t.size() == fd.y.size());
-
     auto fdf = gsl_multifit_nlinear_fdf();
-    auto fdf_params = gsl_multifit_nlinear_default_parameters();
-    
     fdf.f   = f;
     fdf.df  = df;
     fdf.fvv = fvv;
-    fdf.n   = fd.t.size();
-    fdf.p   = initial_params->size;
+    fdf.n   = fd.n;
+    fdf.p   = n_params;
     fdf.params = &fd;
+    return fdf;
+}
 
-    // "This selects the Levenberg-Marquardt algorithm with geodesic acceleration."
-    fdf_params.trs = gsl_multifit_nlinear_trs_lmaccel;
+template<typename C1>
+auto curve_fit_impl(func_f_type f, func_df_type df, func_fvv_type fvv, gsl_vector* initial_params, fit_data<C1>& fd) -> std::vector<double>
+{
+    auto fdf = internal_make_fdf(f, df, fvv, initial_params->size, fd);
+    auto fdf_params = internal_default_parameters();
     return internal_solve_system(initial_params, &fdf, &fdf_params);
 }
 
@@ -120,7 +344,8 @@ auto curve_fit_impl(func_f_type f, func_df_type df, func_fvv_type fvv, gsl_vecto
  * Performs a non-linear least-squares fit.
  * 
  * @param f a function of type double (double x, double c1, double c2, ..., double cn)
- * where  c1, ..., cn are the coefficients to be fitted.
+ * where  c1, ..., cn are the coefficients to be fitted, or a vector model (see
+ * is_vector_model) that evaluates all points at once.
  * @param initial_params intial guess for the parameters. The size of the array must to 
  * be equal to the number of coefficients to be fitted.
  * @param x the idependent data.
@@ -130,11 +355,228 @@ auto curve_fit_impl(func_f_type f, func_df_type df, func_fvv_type fvv, gsl_vecto
 template<typename Callable>
 auto curve_fit(Callable f, const std::vector<double>& initial_params, const std::vector<double>& x, const std::vector<double>& y) -> std::vector<double>
 {
-    // We can't pass lambdas without convert to std::function.
+    assert(x.size() == y.size());
+
+    auto params = internal_make_gsl_vector_ptr(initial_params);
+    auto fd = fit_data<Callable>{x.data(), y.data(), x.size(), f};
+
+    if constexpr (is_vector_model<Callable>::value)
+    {
+        constexpr auto n = Callable::n_params;
+        assert(initial_params.size() == n);
+        func_df_type df = nullptr;
+        if constexpr (has_vector_jacobian<Callable>::value) df = internal_df_vector<decltype(fd), n>;
+        return curve_fit_impl(internal_f_vector<decltype(fd), n>, df, nullptr, params, fd);
+    }
+    else
+    {
+        // We can't pass lambdas without convert to std::function.
+        constexpr auto n = decltype(n_params(std::function(f)))::n_args - 1;
+        assert(initial_params.size() == n);
+        return curve_fit_impl(internal_f<decltype(fd), n>, nullptr, nullptr, params,  fd);
+    }
+}
+
+
+/**
+ * Performs a non-linear least-squares fit with an analytic Jacobian, so gsl doesn't
+ * spend p + 1 evaluations of f per iteration on finite differences.
+ *
+ * @param f a function of type double (double x, double c1, double c2, ..., double cn).
+ * @param df the gradient of f with respect to the coefficients, a function of type
+ * std::array<double, n> (double x, double c1, double c2, ..., double cn).
+ * @param initial_params intial guess for the parameters.
+ * @param x the idependent data.
+ * @param y the dependent data, must to have the same size as x.
+ * @return std::vector<double> with the computed coefficients
+ */
+template<typename Callable, typename Gradient>
+auto curve_fit(Callable f, Gradient df, const std::vector<double>& initial_params, const std::vector<double>& x, const std::vector<double>& y) -> std::vector<double>
+{
     constexpr auto n = decltype(n_params(std::function(f)))::n_args - 1;
     assert(initial_params.size() == n);
 
+    assert(x.size() == y.size());
+
     auto params = internal_make_gsl_vector_ptr(initial_params);
-    auto fd = fit_data<Callable>{x, y, f};
-    return curve_fit_impl(internal_f<decltype(fd), n>, nullptr, nullptr, params,  fd);
-}
\ No newline at end of file
+    auto fd = fit_data_df<Callable, Gradient>{{x.data(), y.data(), x.size(), f}, df};
+    return curve_fit_impl(internal_f<decltype(fd), n>, internal_df<decltype(fd), n>, nullptr, params, fd);
+}
+
+/**
+ * Performs a non-linear least-squares fit with the Jacobian and the geodesic
+ * acceleration term computed by automatic differentiation.
+ *
+ * @param f a generic model, e.g. [](auto x, auto a, auto b) { return a * exp(-b * x); },
+ * called with double and with autodiff::dual coefficients. Math functions must be
+ * called unqualified (exp, not std::exp).
+ * @param initial_params intial guess for the parameters.
+ * @param x the idependent data.
+ * @param y the dependent data, must to have the same size as x.
+ * @return std::vector<double> with the computed coefficients
+ */
+template<typename Callable>
+auto curve_fit_autodiff(Callable f, const std::vector<double>& initial_params, const std::vector<double>& x, const std::vector<double>& y) -> std::vector<double>
+{
+    constexpr auto n = model_arity<Callable>();
+    assert(initial_params.size() == n);
+
+    assert(x.size() == y.size());
+
+    auto params = internal_make_gsl_vector_ptr(initial_params);
+    auto fd = fit_data<Callable>{x.data(), y.data(), x.size(), f};
+    return curve_fit_impl(internal_f<decltype(fd), n>, internal_df_autodiff<decltype(fd), n>,
+                          internal_fvv_autodiff<decltype(fd), n>, params, fd);
+}
+
+
+template <typename F, size_t N, size_t... Is>
+constexpr auto internal_has_autodiff(std::index_sequence<Is...>) -> bool
+{
+    return std::is_invocable_v<F, double, decltype((void)Is, autodiff::dual<double, N>())...>;
+}
+
+/**
+ * The gsl callbacks for a model with n coefficients: a vector model is evaluated over
+ * all points at once, with its own jacobian() if it has one. Derivatives of scalar
+ * models are computed by automatic differentiation when the model accepts
+ * autodiff::dual coefficients (a generic lambda), by finite differences otherwise.
+ */
+template<size_t n, typename C1>
+auto internal_make_model_fdf(fit_data<C1>& fd) -> gsl_multifit_nlinear_fdf
+{
+    using data_type = fit_data<C1>;
+    if constexpr (is_vector_model<C1>::value)
+    {
+        func_df_type df = nullptr;
+        if constexpr (has_vector_jacobian<C1>::value) df = internal_df_vector<data_type, n>;
+        return internal_make_fdf(internal_f_vector<data_type, n>, df, nullptr, n, fd);
+    }
+    else if constexpr (internal_has_autodiff<C1, n>(std::make_index_sequence<n>{}))
+        return internal_make_fdf(internal_f<data_type, n>, internal_df_autodiff<data_type, n>,
+                                 internal_fvv_autodiff<data_type, n>, n, fd);
+    else
+        return internal_make_fdf(internal_f<data_type, n>, nullptr, nullptr, n, fd);
+}
+
+
+/**
+ * A gsl workspace sized for n points and p parameters. It is only reallocated when
+ * the shape changes, so fits of equally sized data reuse it.
+ */
+class fit_workspace
+{
+public:
+    fit_workspace() = default;
+    fit_workspace(const fit_workspace&) = delete;
+    auto operator=(const fit_workspace&) -> fit_workspace& = delete;
+    fit_workspace(fit_workspace&& other) noexcept : work(other.work), n(other.n), p(other.p)
+    {
+        other.work = nullptr;
+    }
+    ~fit_workspace() { release(); }
+
+    auto get(size_t points, size_t n_params) -> gsl_multifit_nlinear_workspace*
+    {
+        if(work == nullptr || n != points || p != n_params)
+        {
+            release();
+            auto fdf_params = internal_default_parameters();
+            work = gsl_multifit_nlinear_alloc(gsl_multifit_nlinear_trust, &fdf_params, points, n_params);
+            n = points;
+            p = n_params;
+        }
+        return work;
+    }
+
+    void release()
+    {
+        if(work != nullptr) gsl_multifit_nlinear_free(work);
+        work = nullptr;
+    }
+
+private:
+    gsl_multifit_nlinear_workspace* work = nullptr;
+    size_t n = 0;
+    size_t p = 0;
+};
+
+
+/**
+ * Counters of the last fit done by a curve_fitter.
+ */
+struct fit_stats
+{
+    // gsl status of the driver, GSL_SUCCESS when it converged
+    int status = GSL_SUCCESS;
+    size_t niter = 0;
+    // evaluations of f, of the Jacobian and of the geodesic acceleration term
+    size_t nevalf = 0;
+    size_t nevaldf = 0;
+    size_t nevalfvv = 0;
+};
+
+
+/**
+ * Fits one model to many data sets. The gsl workspace is allocated on the first fit
+ * and reinitialized in place for each further fit of the same size, and the initial
+ * parameters are viewed in place, so a fit loop does not allocate. Generic models get
+ * their derivatives by automatic differentiation.
+ */
+template<typename Model>
+class curve_fitter
+{
+public:
+    static constexpr size_t n_params = model_arity<Model>();
+
+    explicit curve_fitter(Model f) : fd{nullptr, nullptr, 0, f}
+    {
+    }
+
+    curve_fitter(const curve_fitter&) = delete;
+    auto operator=(const curve_fitter&) -> curve_fitter& = delete;
+
+    /**
+     * Fits the model to the n points (x[i], y[i]), starting from initial_params.
+     *
+     * @param initial_params n_params values.
+     * @param result n_params values, receives the computed coefficients.
+     * @return the gsl status of the fit, GSL_SUCCESS when it converged.
+     */
+    auto fit(const double* initial_params, const double* x, const double* y, size_t n, double* result) -> int
+    {
+        fd.t = x;
+        fd.y = y;
+        fd.n = n;
+        auto fdf = internal_make_model_fdf<n_params>(fd);
+        auto guess = gsl_vector_const_view_array(initial_params, n_params);
+        auto* work = workspace.get(n, n_params);
+
+        last.status   = internal_solve_system(&guess.vector, &fdf, work, result);
+        last.niter    = gsl_multifit_nlinear_niter(work);
+        last.nevalf   = fdf.nevalf;
+        last.nevaldf  = fdf.nevaldf;
+        last.nevalfvv = fdf.nevalfvv;
+        return last.status;
+    }
+
+    auto fit(const std::vector<double>& initial_params, const std::vector<double>& x, const std::vector<double>& y) -> std::vector<double>
+    {
+        assert(initial_params.size() == n_params);
+        assert(x.size() == y.size());
+
+        auto result = std::vector<double>(n_params);
+        fit(initial_params.data(), x.data(), y.data(), x.size(), result.data());
+        return result;
+    }
+
+    /**
+     * Counters of the last fit.
+     */
+    auto stats() const -> const fit_stats& { return last; }
+
+private:
+    fit_data<Model> fd;
+    fit_workspace workspace;
+    fit_stats last;
+};
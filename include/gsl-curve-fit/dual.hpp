@@ -0,0 +1,282 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <type_traits>
+
+// Forward-mode automatic differentiation with dual numbers.
+// A dual<T, N> carries a value and its N partial derivatives; nesting them
+// (dual<dual<double, 1>, 1>) gives second derivatives along one direction.
+// Models written as generic lambdas, e.g.
+//
+//     [](auto x, auto a, auto b) { return a * exp(-b * x); }
+//
+// work unchanged with double and dual arguments as long as the math functions
+// are called unqualified (exp, not std::exp) so they are found by lookup.
+
+namespace autodiff
+{
+
+template<typename T, size_t N>
+struct dual
+{
+    T v{};
+    std::array<T, N> d{};
+
+    dual() = default;
+    dual(double c) : v(c) {}
+    dual(const T& value, const std::array<T, N>& derivatives) : v(value), d(derivatives) {}
+
+    /**
+     * The independent variable number index, with a unit derivative along it.
+     */
+    static auto variable(const T& value, size_t index) -> dual
+    {
+        auto r = dual(value, {});
+        r.d[index] = T(1.0);
+        return r;
+    }
+};
+
+template<typename T>
+struct is_dual : std::false_type {};
+
+template<typename T, size_t N>
+struct is_dual<dual<T, N>> : std::true_type {};
+
+/**
+ * Applies the chain rule: given g = f(u.v) and g1 = f'(u.v), returns f(u).
+ */
+template<typename T, size_t N>
+auto internal_chain(const dual<T, N>& u, const T& g, const T& g1) -> dual<T, N>
+{
+    auto r = dual<T, N>(g, {});
+    for(size_t j = 0; j < N; j++) r.d[j] = g1 * u.d[j];
+    return r;
+}
+
+inline auto value(double u) -> double
+{
+    return u;
+}
+
+template<typename T, size_t N>
+auto value(const dual<T, N>& u) -> double
+{
+    return value(u.v);
+}
+
+// arithmetic
+
+template<typename T, size_t N>
+auto operator+(const dual<T, N>& a) -> dual<T, N>
+{
+    return a;
+}
+
+template<typename T, size_t N>
+auto operator-(const dual<T, N>& a) -> dual<T, N>
+{
+    auto r = dual<T, N>(-a.v, {});
+    for(size_t j = 0; j < N; j++) r.d[j] = -a.d[j];
+    return r;
+}
+
+template<typename T, size_t N>
+auto operator+(const dual<T, N>& a, const dual<T, N>& b) -> dual<T, N>
+{
+    auto r = dual<T, N>(a.v + b.v, {});
+    for(size_t j = 0; j < N; j++) r.d[j] = a.d[j] + b.d[j];
+    return r;
+}
+
+template<typename T, size_t N>
+auto operator-(const dual<T, N>& a, const dual<T, N>& b) -> dual<T, N>
+{
+    auto r = dual<T, N>(a.v - b.v, {});
+    for(size_t j = 0; j < N; j++) r.d[j] = a.d[j] - b.d[j];
+    return r;
+}
+
+template<typename T, size_t N>
+auto operator*(const dual<T, N>& a, const dual<T, N>& b) -> dual<T, N>
+{
+    auto r = dual<T, N>(a.v * b.v, {});
+    for(size_t j = 0; j < N; j++) r.d[j] = a.d[j] * b.v + a.v * b.d[j];
+    return r;
+}
+
+template<typename T, size_t N>
+auto operator/(const dual<T, N>& a, const dual<T, N>& b) -> dual<T, N>
+{
+    const T inv = 1.0 / b.v;
+    const T q = a.v * inv;
+    auto r = dual<T, N>(q, {});
+    for(size_t j = 0; j < N; j++) r.d[j] = (a.d[j] - q * b.d[j]) * inv;
+    return r;
+}
+
+template<typename T, size_t N>
+auto operator+(const dual<T, N>& a, double b) -> dual<T, N>
+{
+    return dual<T, N>(a.v + b, a.d);
+}
+
+template<typename T, size_t N>
+auto operator+(double a, const dual<T, N>& b) -> dual<T, N>
+{
+    return dual<T, N>(a + b.v, b.d);
+}
+
+template<typename T, size_t N>
+auto operator-(const dual<T, N>& a, double b) -> dual<T, N>
+{
+    return dual<T, N>(a.v - b, a.d);
+}
+
+template<typename T, size_t N>
+auto operator-(double a, const dual<T, N>& b) -> dual<T, N>
+{
+    return a + (-b);
+}
+
+template<typename T, size_t N>
+auto operator*(const dual<T, N>& a, double b) -> dual<T, N>
+{
+    auto r = dual<T, N>(a.v * b, {});
+    for(size_t j = 0; j < N; j++) r.d[j] = a.d[j] * b;
+    return r;
+}
+
+template<typename T, size_t N>
+auto operator*(double a, const dual<T, N>& b) -> dual<T, N>
+{
+    return b * a;
+}
+
+template<typename T, size_t N>
+auto operator/(const dual<T, N>& a, double b) -> dual<T, N>
+{
+    return a * (1.0 / b);
+}
+
+template<typename T, size_t N>
+auto operator/(double a, const dual<T, N>& b) -> dual<T, N>
+{
+    const T inv = 1.0 / b.v;
+    return internal_chain(b, a * inv, -a * inv * inv);
+}
+
+template<typename T, size_t N, typename U>
+auto operator+=(dual<T, N>& a, const U& b) -> dual<T, N>& { return a = a + b; }
+
+template<typename T, size_t N, typename U>
+auto operator-=(dual<T, N>& a, const U& b) -> dual<T, N>& { return a = a - b; }
+
+template<typename T, size_t N, typename U>
+auto operator*=(dual<T, N>& a, const U& b) -> dual<T, N>& { return a = a * b; }
+
+template<typename T, size_t N, typename U>
+auto operator/=(dual<T, N>& a, const U& b) -> dual<T, N>& { return a = a / b; }
+
+// comparisons look at the value only, so models can branch
+
+template<typename A, typename B, typename = std::enable_if_t<is_dual<A>::value || is_dual<B>::value>>
+auto operator<(const A& a, const B& b) -> bool { return value(a) < value(b); }
+
+template<typename A, typename B, typename = std::enable_if_t<is_dual<A>::value || is_dual<B>::value>>
+auto operator>(const A& a, const B& b) -> bool { return value(a) > value(b); }
+
+template<typename A, typename B, typename = std::enable_if_t<is_dual<A>::value || is_dual<B>::value>>
+auto operator<=(const A& a, const B& b) -> bool { return value(a) <= value(b); }
+
+template<typename A, typename B, typename = std::enable_if_t<is_dual<A>::value || is_dual<B>::value>>
+auto operator>=(const A& a, const B& b) -> bool { return value(a) >= value(b); }
+
+// math functions, each one is f(u) with f'(u) for the chain rule
+
+template<typename T, size_t N>
+auto exp(const dual<T, N>& u) -> dual<T, N>
+{
+    using std::exp;
+    const T e = exp(u.v);
+    return internal_chain(u, e, e);
+}
+
+template<typename T, size_t N>
+auto log(const dual<T, N>& u) -> dual<T, N>
+{
+    using std::log;
+    return internal_chain(u, log(u.v), 1.0 / u.v);
+}
+
+template<typename T, size_t N>
+auto sqrt(const dual<T, N>& u) -> dual<T, N>
+{
+    using std::sqrt;
+    const T s = sqrt(u.v);
+    return internal_chain(u, s, 0.5 / s);
+}
+
+template<typename T, size_t N>
+auto pow(const dual<T, N>& u, double p) -> dual<T, N>
+{
+    using std::pow;
+    return internal_chain(u, pow(u.v, p), p * pow(u.v, p - 1.0));
+}
+
+template<typename T, size_t N>
+auto sin(const dual<T, N>& u) -> dual<T, N>
+{
+    using std::sin;
+    using std::cos;
+    return internal_chain(u, sin(u.v), cos(u.v));
+}
+
+template<typename T, size_t N>
+auto cos(const dual<T, N>& u) -> dual<T, N>
+{
+    using std::sin;
+    using std::cos;
+    return internal_chain(u, cos(u.v), -sin(u.v));
+}
+
+template<typename T, size_t N>
+auto tanh(const dual<T, N>& u) -> dual<T, N>
+{
+    using std::tanh;
+    const T t = tanh(u.v);
+    return internal_chain(u, t, 1.0 - t * t);
+}
+
+template<typename T, size_t N>
+auto atan(const dual<T, N>& u) -> dual<T, N>
+{
+    using std::atan;
+    return internal_chain(u, atan(u.v), 1.0 / (1.0 + u.v * u.v));
+}
+
+template<typename T, size_t N>
+auto erf(const dual<T, N>& u) -> dual<T, N>
+{
+    using std::erf;
+    using std::exp;
+    // 2 / sqrt(pi)
+    const double c = 1.1283791670955126;
+    return internal_chain(u, erf(u.v), c * exp(-u.v * u.v));
+}
+
+template<typename T, size_t N>
+auto abs(const dual<T, N>& u) -> dual<T, N>
+{
+    return value(u) < 0.0 ? -u : u;
+}
+
+template<typename T, size_t N>
+auto fabs(const dual<T, N>& u) -> dual<T, N>
+{
+    return abs(u);
+}
+
+}
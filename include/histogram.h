@@ -0,0 +1,105 @@
+#pragma once
+
+// Online histograms for pulse-height and charge spectra. Each producing thread fills
+// its own Histogram without synchronization and periodically merges it into one
+// SharedHistogram with atomic adds, so readers can take a snapshot or checkpoint the
+// spectrum to disk at any time while events keep arriving.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// bins equal bins over [lo, hi), index 0 is the underflow and bins + 1 the overflow
+struct HistogramAxis {
+	size_t bins = 1000;
+	double lo = 0;
+	double hi = 1;
+
+	double width() const { return (hi - lo) / bins; }
+	double center(size_t bin) const { return lo + (bin + 0.5) * width(); }	//bin in [0, bins)
+
+	size_t index(double x) const {
+		if (!(x >= lo)) return 0;		//also NaN
+		if (x >= hi) return bins + 1;
+		size_t bin = static_cast<size_t>((x - lo) / (hi - lo) * bins);
+		return 1 + std::min(bin, bins - 1);
+	}
+};
+
+// Histogram owned by one thread
+class Histogram {
+public:
+	explicit Histogram(const HistogramAxis& axis) : axis_(axis), counts_(axis.bins + 2, 0) {}
+
+	void fill(double x) { counts_[axis_.index(x)]++; }
+
+	void clear() { std::fill(counts_.begin(), counts_.end(), 0); }
+
+	const HistogramAxis& axis() const { return axis_; }
+	const std::vector<uint64_t>& counts() const { return counts_; }	//with underflow and overflow
+
+private:
+	HistogramAxis axis_;
+	std::vector<uint64_t> counts_;
+};
+
+// Histogram merged from any number of threads, all operations are lock-free
+class SharedHistogram {
+public:
+	explicit SharedHistogram(const HistogramAxis& axis) : axis_(axis), counts_(new std::atomic<uint64_t>[axis.bins + 2]) {
+		for (size_t i = 0; i < axis_.bins + 2; i++) counts_[i].store(0, std::memory_order_relaxed);
+	}
+
+	// adds the counts of local and clears it
+	void merge(Histogram& local) {
+		const std::vector<uint64_t>& counts = local.counts();
+		for (size_t i = 0; i < counts.size(); i++) {
+			if (counts[i] != 0) counts_[i].fetch_add(counts[i], std::memory_order_relaxed);
+		}
+		local.clear();
+	}
+
+	// counts of all bins with underflow and overflow, consistent per bin
+	std::vector<uint64_t> snapshot() const {
+		std::vector<uint64_t> counts(axis_.bins + 2);
+		for (size_t i = 0; i < counts.size(); i++) counts[i] = counts_[i].load(std::memory_order_relaxed);
+		return counts;
+	}
+
+	const HistogramAxis& axis() const { return axis_; }
+
+	// writes "bin center,count" lines, first to filename.tmp then renamed over filename so
+	// an interrupted run always leaves the last complete checkpoint behind
+	bool save(const std::string& filename) const {
+		std::vector<uint64_t> counts = snapshot();
+		std::string temporary = filename + ".tmp";
+		std::FILE* file = std::fopen(temporary.c_str(), "wb");
+		if (file == nullptr) {
+			printf("Error creating %s\n", temporary.c_str());
+			return false;
+		}
+		std::fprintf(file, "# underflow %llu, overflow %llu\n",
+			static_cast<unsigned long long>(counts[0]), static_cast<unsigned long long>(counts[axis_.bins + 1]));
+		for (size_t bin = 0; bin < axis_.bins; bin++) {
+			std::fprintf(file, "%.9g,%llu\n", axis_.center(bin), static_cast<unsigned long long>(counts[bin + 1]));
+		}
+		bool written = std::fclose(file) == 0;
+		std::error_code error;
+		if (written) std::filesystem::rename(temporary, filename, error);
+		if (!written || error) {
+			printf("Error writing %s\n", filename.c_str());
+			return false;
+		}
+		return true;
+	}
+
+private:
+	HistogramAxis axis_;
+	std::unique_ptr<std::atomic<uint64_t>[]> counts_;
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+// Reader for IEEE 488.2 binary blocks as returned by curve?:
+//   definite length   #<n><length><payload><terminator>, n digits give the payload length
+//   indefinite length #0<payload>\n, terminated by the end of the message (not over a raw socket)
+// The header is parsed on its own, the payload is read in fixed-size chunks straight
+// into the caller's buffer (no intermediate copy), then the terminator is consumed.
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+
+#include "visa.h"
+#include "visatype.h"
+#include "latency.h"
+#include "transport.h"
+
+static const size_t blockChunkSize = 1 << 20;	//bytes per viRead of the payload
+
+// Reads and drops the rest of the current response so the next query starts in sync,
+// a termination character ends it too: it is the only message end a raw socket has
+inline void DiscardResponse(const ViSession& instr, ViUInt32& retCount) {
+	ViUInt8 scratch[4096];
+	ViStatus status;
+	do {
+		status = transportRead(instr, scratch, sizeof(scratch), &retCount);
+	} while (status == VI_SUCCESS_MAX_CNT && retCount > 0);
+}
+
+// Drops the length payload bytes of a block that isn't stored, then its terminator;
+// in binary mode so a raw socket doesn't take a '\n' among the samples for the end
+inline void DiscardPayload(const ViSession& instr, size_t length, ViUInt32& retCount) {
+	ViUInt8 scratch[4096];
+	ViStatus status = VI_SUCCESS_MAX_CNT;
+	{
+		BinaryReadScope binary(instr);
+		while (length > 0) {
+			status = transportRead(instr, scratch, static_cast<ViUInt32>(std::min(sizeof(scratch), length)), &retCount);
+			if (status < VI_SUCCESS || retCount == 0) return;
+			length -= std::min<size_t>(retCount, length);
+			if (status == VI_SUCCESS && length > 0) return;		//message ended early
+		}
+	}
+	if (status != VI_SUCCESS) DiscardResponse(instr, retCount);
+}
+
+// Reads one block into destination (capacity bytes), nBytes is set to the payload length.
+// Returns 0 on success, 6 if the block is malformed, larger than capacity or cut short.
+inline int ReadIeeeBlock(
+	const ViSession& instr,
+	void* destination,
+	size_t capacity,
+	size_t& nBytes,
+	ViUInt32& retCount,
+	size_t chunkSize = blockChunkSize) {
+
+	ViUInt8* dst = static_cast<ViUInt8*>(destination);
+	char header[12];
+	nBytes = 0;
+
+	ViStatus status = transportRead(instr, reinterpret_cast<ViUInt8*>(header), 2, &retCount);
+	if (status < VI_SUCCESS || retCount != 2 || header[0] != '#' || header[1] < '0' || header[1] > '9') {
+		printf("Invalid IEEE block header\n");
+		if (status == VI_SUCCESS_MAX_CNT || status == VI_SUCCESS_TERM_CHAR) DiscardResponse(instr, retCount);
+		return 6;
+	}
+
+	size_t digits = header[1] - '0';
+	Transport* transport = findTransport(instr);
+	if (digits == 0 && transport != nullptr && transport->kind() == TransportKind::Socket) {
+		//a raw socket ends messages only at '\n', which may as well be a sample
+		printf("Indefinite-length IEEE block can't be framed over a raw socket\n");
+		DiscardResponse(instr, retCount);
+		return 6;
+	}
+	if (digits == 0) {
+		//indefinite length: payload runs until the end of the message, last byte is '\n'
+		do {
+			if (nBytes == capacity) {
+				printf("IEEE block larger than %zu bytes\n", capacity);
+				DiscardResponse(instr, retCount);
+				return 6;
+			}
+			LatencyTimer timer(LatencyStage::Read);
+			status = transportRead(instr, dst + nBytes, static_cast<ViUInt32>(std::min(chunkSize, capacity - nBytes)), &retCount);
+			timer.stop();
+			nBytes += retCount;
+		} while (status == VI_SUCCESS_MAX_CNT || status == VI_SUCCESS_TERM_CHAR);
+		if (status < VI_SUCCESS) {
+			printf("Error reading IEEE block\n");
+			return 6;
+		}
+		if (nBytes > 0 && dst[nBytes - 1] == '\n') nBytes--;
+		return 0;
+	}
+
+	size_t length = 0;
+	status = transportRead(instr, reinterpret_cast<ViUInt8*>(header + 2), static_cast<ViUInt32>(digits), &retCount);
+	if (status < VI_SUCCESS || retCount != digits
+		|| std::from_chars(header + 2, header + 2 + digits, length).ptr != header + 2 + digits) {
+		printf("Invalid IEEE block length\n");
+		if (status == VI_SUCCESS_MAX_CNT || status == VI_SUCCESS_TERM_CHAR) DiscardResponse(instr, retCount);
+		return 6;
+	}
+	if (length > capacity) {
+		printf("IEEE block of %zu bytes does not fit in %zu\n", length, capacity);
+		DiscardPayload(instr, length, retCount);
+		return 6;
+	}
+
+	//payload, reads stop early at a termination character so keep going until length bytes
+	status = VI_SUCCESS_MAX_CNT;
+	{
+		BinaryReadScope binary(instr);		//a raw socket must not stop at '\n' inside the samples
+		while (nBytes < length) {
+			LatencyTimer timer(LatencyStage::Read);
+			status = transportRead(instr, dst + nBytes, static_cast<ViUInt32>(std::min(chunkSize, length - nBytes)), &retCount);
+			timer.stop();
+			nBytes += retCount;
+			if (status < VI_SUCCESS || (status == VI_SUCCESS && nBytes < length) || retCount == 0) {
+				printf("Short IEEE block: %zu of %zu bytes\n", nBytes, length);
+				if (status == VI_SUCCESS_MAX_CNT || status == VI_SUCCESS_TERM_CHAR) DiscardResponse(instr, retCount);
+				return 6;
+			}
+		}
+	}
+
+	//terminator, unless the end of the message came with the last payload byte
+	if (status != VI_SUCCESS) DiscardResponse(instr, retCount);
+	return 0;
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+// Always-on latency instrumentation: each stage of the acquisition (instrument I/O,
+// trigger wait, curve? transfer, decode, csv formatting, file close) records its
+// duration into an HDR-style histogram, log2 magnitude buckets each split into 32
+// linear sub-buckets, so percentiles are within ~3 % at any scale with a fixed,
+// preallocated table. Recording is a steady_clock read and one relaxed atomic add.
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+enum class LatencyStage { Write, Read, Query, TriggerWait, Curve, Decode, Store, Csv, Close, Count };
+
+inline const char* latencyStageName(LatencyStage stage) {
+	static const char* const names[] = { "write", "read", "query", "trigger wait", "curve", "decode", "store", "csv", "close" };
+	return names[static_cast<int>(stage)];
+}
+
+class LatencyHistogram {
+public:
+	static constexpr int subBits = 5;								//32 sub-buckets per power of two
+	static constexpr int maxBits = 40;								//values are clamped to 2^40 ns, ~18 min
+	static constexpr size_t nBuckets = (maxBits - subBits + 1) << subBits;
+
+	LatencyHistogram() { reset(); }
+
+	void record(uint64_t ns) {
+		counts_[index(ns)].fetch_add(1, std::memory_order_relaxed);
+		count_.fetch_add(1, std::memory_order_relaxed);
+		sum_.fetch_add(ns, std::memory_order_relaxed);
+		uint64_t max = max_.load(std::memory_order_relaxed);
+		while (ns > max && !max_.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+	}
+
+	void reset() {
+		for (auto& c : counts_) c.store(0, std::memory_order_relaxed);
+		count_.store(0, std::memory_order_relaxed);
+		sum_.store(0, std::memory_order_relaxed);
+		max_.store(0, std::memory_order_relaxed);
+	}
+
+	uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+	uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+	double mean() const { return count() > 0 ? static_cast<double>(sum_.load(std::memory_order_relaxed)) / count() : 0.0; }
+
+	// value below which a fraction q of the recorded durations fall, ns
+	uint64_t percentile(double q) const {
+		uint64_t n = count();
+		if (n == 0) return 0;
+		uint64_t rank = static_cast<uint64_t>(q * (n - 1)) + 1, seen = 0;
+		for (size_t i = 0; i < nBuckets; i++) {
+			seen += counts_[i].load(std::memory_order_relaxed);
+			if (seen >= rank) return std::min(middle(i), max());
+		}
+		return max();
+	}
+
+private:
+	static int msb(uint64_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+		return 63 - __builtin_clzll(v);
+#elif defined(_MSC_VER) && defined(_M_X64)
+		unsigned long bit;
+		_BitScanReverse64(&bit, v);
+		return static_cast<int>(bit);
+#else
+		int bit = 0;
+		while (v >>= 1) bit++;
+		return bit;
+#endif
+	}
+
+	// values below 32 get their own bucket, above that the group is the magnitude and
+	// the sub-bucket the next 5 bits after the leading one
+	static size_t index(uint64_t v) {
+		if (v >= (uint64_t(1) << maxBits)) v = (uint64_t(1) << maxBits) - 1;
+		if (v < (uint64_t(1) << subBits)) return static_cast<size_t>(v);
+		int group = msb(v) - subBits + 1;
+		size_t sub = static_cast<size_t>(v >> (group - 1)) & ((size_t(1) << subBits) - 1);
+		return (static_cast<size_t>(group) << subBits) + sub;
+	}
+
+	static uint64_t middle(size_t i) {
+		if (i < (size_t(1) << subBits)) return i;
+		size_t group = i >> subBits, sub = i & ((size_t(1) << subBits) - 1);
+		uint64_t lower = (uint64_t((size_t(1) << subBits) + sub)) << (group - 1);
+		return lower + ((uint64_t(1) << (group - 1)) >> 1);
+	}
+
+	std::array<std::atomic<uint64_t>, nBuckets> counts_;
+	std::atomic<uint64_t> count_, sum_, max_;
+};
+
+// Histograms of all stages plus event and byte counters for the throughput of a run
+class LatencyStats {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	// clears everything and starts the throughput clock
+	void start() {
+		for (auto& h : stages_) h.reset();
+		events_.store(0, std::memory_order_relaxed);
+		bytes_.store(0, std::memory_order_relaxed);
+		start_ = Clock::now();
+	}
+
+	void record(LatencyStage stage, Clock::duration d) {
+		stages_[static_cast<int>(stage)].record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()));
+	}
+
+	void addEvents(size_t n) { events_.fetch_add(n, std::memory_order_relaxed); }
+	void addBytes(size_t n) { bytes_.fetch_add(n, std::memory_order_relaxed); }
+
+	const LatencyHistogram& stage(LatencyStage s) const { return stages_[static_cast<int>(s)]; }
+	double elapsed() const { return std::chrono::duration<double>(Clock::now() - start_).count(); }
+
+	// p50/p99/max per stage that saw any calls, then events/s and MB/s since start()
+	void print(std::ostream& os) const {
+		char line[160];
+		std::snprintf(line, sizeof(line), "%-13s %10s %10s %10s %10s %10s\n", "stage", "count", "p50 us", "p99 us", "max us", "mean us");
+		os << line;
+		for (int s = 0; s < static_cast<int>(LatencyStage::Count); s++) {
+			const LatencyHistogram& h = stages_[s];
+			if (h.count() == 0) continue;
+			std::snprintf(line, sizeof(line), "%-13s %10llu %10.1f %10.1f %10.1f %10.1f\n", latencyStageName(static_cast<LatencyStage>(s)),
+				static_cast<unsigned long long>(h.count()), h.percentile(0.5) / 1e3, h.percentile(0.99) / 1e3, h.max() / 1e3, h.mean() / 1e3);
+			os << line;
+		}
+		double seconds = elapsed();
+		os << "events/s: " << events_.load() / seconds << ", MB/s: " << bytes_.load() / seconds / 1e6 << '\n';
+	}
+
+	// same numbers as print() as a JSON object, durations in microseconds
+	bool writeJson(const std::string& filename) const {
+		std::FILE* file = std::fopen(filename.c_str(), "w");
+		if (file == nullptr) {
+			printf("Error creating %s\n", filename.c_str());
+			return false;
+		}
+		double seconds = elapsed();
+		std::fprintf(file, "{\n  \"elapsed_s\": %.6f,\n  \"events\": %llu,\n  \"bytes\": %llu,\n  \"events_per_s\": %.3f,\n  \"mb_per_s\": %.3f,\n  \"stages\": {",
+			seconds, static_cast<unsigned long long>(events_.load()), static_cast<unsigned long long>(bytes_.load()),
+			events_.load() / seconds, bytes_.load() / seconds / 1e6);
+		const char* separator = "\n";
+		for (int s = 0; s < static_cast<int>(LatencyStage::Count); s++) {
+			const LatencyHistogram& h = stages_[s];
+			if (h.count() == 0) continue;
+			std::fprintf(file, "%s    \"%s\": { \"count\": %llu, \"p50_us\": %.3f, \"p99_us\": %.3f, \"max_us\": %.3f, \"mean_us\": %.3f }",
+				separator, latencyStageName(static_cast<LatencyStage>(s)), static_cast<unsigned long long>(h.count()),
+				h.percentile(0.5) / 1e3, h.percentile(0.99) / 1e3, h.max() / 1e3, h.mean() / 1e3);
+			separator = ",\n";
+		}
+		std::fprintf(file, "\n  }\n}\n");
+		return std::fclose(file) == 0;
+	}
+
+private:
+	std::array<LatencyHistogram, static_cast<int>(LatencyStage::Count)> stages_;
+	std::atomic<uint64_t> events_{ 0 }, bytes_{ 0 };
+	Clock::time_point start_ = Clock::now();
+};
+
+// process-wide statistics, recorded to from any thread
+inline LatencyStats& latencyStats() {
+	static LatencyStats stats;
+	return stats;
+}
+
+// records the time from construction to destruction (or stop()) as one sample of stage
+class LatencyTimer {
+public:
+	explicit LatencyTimer(LatencyStage stage) : stage_(stage), start_(LatencyStats::Clock::now()) {}
+	~LatencyTimer() { stop(); }
+	LatencyTimer(const LatencyTimer&) = delete;
+	LatencyTimer& operator=(const LatencyTimer&) = delete;
+
+	void stop() {
+		if (stopped_) return;
+		latencyStats().record(stage_, LatencyStats::Clock::now() - start_);
+		stopped_ = true;
+	}
+
+private:
+	LatencyStage stage_;
+	LatencyStats::Clock::time_point start_;
+	bool stopped_ = false;
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+// Three stage acquisition pipeline: the readout thread (the caller) pushes raw curve?
+// transfers, a decode thread converts them and a storage thread writes them out.
+// Stages are connected by bounded SPSC rings; readout only waits when the decode
+// queue is full (backpressure), which is counted as a stall. The time spent in each
+// decode and store call is recorded in latencyStats().
+
+#include <atomic>
+#include <thread>
+#include <iostream>
+
+#include "spsc_ring.h"
+#include "buffer_pool.h"
+#include "raw_transfer.h"
+#include "latency.h"
+
+struct PulseFeatures;
+
+// Transfer after decoding, volts holds nFrames * recordLength values and features one
+// record per frame (null if not needed)
+template<typename Sample>
+struct DecodedTransfer {
+	RawTransfer<Sample> raw;
+	PooledBuffer<double>* volts = nullptr;
+	PooledBuffer<PulseFeatures>* features = nullptr;
+};
+
+struct QueueStats {
+	size_t pushed = 0;
+	size_t stalls = 0;				//pushes that found the queue full and had to wait
+	size_t maxDepth = 0;
+};
+
+template<typename Raw, typename Decoded>
+class AcquisitionPipeline {
+public:
+	explicit AcquisitionPipeline(size_t queueDepth) : rawQueue_(queueDepth), decodedQueue_(queueDepth) {}
+	~AcquisitionPipeline() { finish(); }
+
+	// decode: void(Raw&, Decoded&), store: void(Decoded&)
+	template<typename DecodeFn, typename StoreFn>
+	void start(DecodeFn decode, StoreFn store) {
+		rawDone_ = false;
+		decodedDone_ = false;
+		decodeThread_ = std::thread([this, decode]() mutable {
+			Raw raw;
+			while (pop(rawQueue_, raw, rawDone_)) {
+				Decoded decoded;
+				LatencyTimer timer(LatencyStage::Decode);
+				decode(raw, decoded);
+				timer.stop();
+				push(decodedQueue_, std::move(decoded), decodedStats_);
+			}
+			decodedDone_.store(true, std::memory_order_release);
+		});
+		storeThread_ = std::thread([this, store]() mutable {
+			Decoded decoded;
+			while (pop(decodedQueue_, decoded, decodedDone_)) {
+				LatencyTimer timer(LatencyStage::Store);
+				store(decoded);
+			}
+		});
+	}
+
+	// readout side, blocks while the decode queue is full
+	void push(Raw&& raw) { push(rawQueue_, std::move(raw), rawStats_); }
+
+	// drains both queues and stops the stage threads
+	void finish() {
+		rawDone_.store(true, std::memory_order_release);
+		if (decodeThread_.joinable()) decodeThread_.join();
+		if (storeThread_.joinable()) storeThread_.join();
+	}
+
+	size_t decodeDepth() const { return rawQueue_.size(); }
+	size_t storeDepth() const { return decodedQueue_.size(); }
+	const QueueStats& decodeStats() const { return rawStats_; }
+	const QueueStats& storeStats() const { return decodedStats_; }
+
+	void printStats() const {
+		std::cout << "decode queue: " << rawStats_.pushed << " transfers, max depth " << rawStats_.maxDepth
+			<< "/" << rawQueue_.capacity() << ", " << rawStats_.stalls << " readout stalls\n"
+			<< "store queue:  " << decodedStats_.pushed << " transfers, max depth " << decodedStats_.maxDepth
+			<< "/" << decodedQueue_.capacity() << ", " << decodedStats_.stalls << " decode stalls\n";
+	}
+
+private:
+	template<typename T>
+	static void push(SpscRing<T>& queue, T&& item, QueueStats& stats) {
+		unsigned spins = 0;
+		if (!queue.tryPush(std::move(item))) {
+			stats.stalls++;
+			while (!queue.tryPush(std::move(item))) ringBackoff(spins);
+		}
+		stats.pushed++;
+		size_t depth = queue.size();
+		if (depth > stats.maxDepth) stats.maxDepth = depth;
+	}
+
+	// false once the upstream stage has finished and the queue is empty
+	template<typename T>
+	static bool pop(SpscRing<T>& queue, T& item, const std::atomic<bool>& upstreamDone) {
+		unsigned spins = 0;
+		while (!queue.tryPop(item)) {
+			if (upstreamDone.load(std::memory_order_acquire)) return queue.tryPop(item);
+			ringBackoff(spins);
+		}
+		return true;
+	}
+
+	SpscRing<Raw> rawQueue_;
+	SpscRing<Decoded> decodedQueue_;
+	QueueStats rawStats_, decodedStats_;
+	std::atomic<bool> rawDone_{ false };
+	std::atomic<bool> decodedDone_{ false };
+	std::thread decodeThread_, storeThread_;
+};
@@ -0,0 +1,146 @@
+#pragma once
+
+// Waveform preamble from a single WFMOutpre? query (header off), parsed with
+// std::from_chars. PreambleCache keeps it for the session and only asks the scope
+// again after a command that can change the transfer format or the scaling.
+
+#include <cctype>
+#include <charconv>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+#include "visa.h"
+#include "visatype.h"
+#include "casts.h"
+#include "vi_c2cpp.h"
+#include "ieee_block.h"
+#include "convert.h"
+
+struct WaveformPreamble {
+	int bytesPerPoint = 1;		//BYT_Nr
+	bool littleEndian = true;	//BYT_Or LSB
+	size_t nPoints = 0;			//NR_Pt
+	double xinc = 0;
+	double xzero = 0;
+	double pt_off = 0;
+	double ymult = 1;
+	double yoff = 0;
+	double yzero = 0;
+
+	ConvertScale scale() const { return { ymult, yzero, yoff }; }
+	double time(double point) const { return (point - pt_off) * xinc + xzero; }
+};
+
+// field positions in the WFMOutpre? reply of the MSO4/5/6 series
+enum PreambleField {
+	preBytNr = 0, preBitNr, preEncdg, preBnFmt, preBytOr, preWfId, preNrPt, prePtFmt, prePtOrder,
+	preXUnit, preXIncr, preXZero, prePtOff, preYUnit, preYMult, preYOff, preYZero, preFieldCount
+};
+
+// Parses "1;8;BINARY;RI;LSB;"Ch2, ...";62500;Y;LINEAR;"s";3.2E-10;..." into preamble.
+// Returns 0 on success, 8 if a field is missing or not a number.
+inline int ParseWaveformPreamble(std::string_view reply, WaveformPreamble& preamble) {
+	std::string_view fields[preFieldCount];
+	size_t nFields = 0;
+	size_t begin = 0;
+	bool quoted = false;
+	for (size_t i = 0; i <= reply.size() && nFields < preFieldCount; i++) {
+		if (i < reply.size() && reply[i] == '"') quoted = !quoted;
+		if (i == reply.size() || (reply[i] == ';' && !quoted)) {
+			fields[nFields++] = reply.substr(begin, i - begin);
+			begin = i + 1;
+		}
+	}
+	if (nFields < preFieldCount) {
+		printf("Incomplete waveform preamble\n");
+		return 8;
+	}
+
+	auto number = [&](PreambleField field, auto& value) {
+		std::string_view text = fields[field];
+		while (!text.empty() && (text.back() == '\n' || text.back() == '\r' || text.back() == ' ')) text.remove_suffix(1);
+		if (!text.empty() && text.front() == '+') text.remove_prefix(1);
+		auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+		return result.ec == std::errc() && result.ptr == text.data() + text.size();
+	};
+	int bytes = 0;
+	double nPoints = 0;
+	WaveformPreamble p;
+	if (!number(preBytNr, bytes) || !number(preNrPt, nPoints) || !number(preXIncr, p.xinc) || !number(preXZero, p.xzero)
+		|| !number(prePtOff, p.pt_off) || !number(preYMult, p.ymult) || !number(preYOff, p.yoff) || !number(preYZero, p.yzero)) {
+		printf("Invalid waveform preamble\n");
+		return 8;
+	}
+	p.bytesPerPoint = bytes;
+	p.nPoints = static_cast<size_t>(nPoints);
+	p.littleEndian = fields[preBytOr] == "LSB";
+	preamble = p;
+	return 0;
+}
+
+// True if a command or a ';'-separated program message changes anything in the preamble:
+// data format and range, source, horizontal settings, vertical scale of any channel,
+// acquisition mode or the WFMOutpre settings themselves
+inline bool AffectsPreamble(std::string_view message) {
+	static const char* const prefixes[] = {
+		"DAT", "HOR", "ACQ:MOD", "ACQUIRE:MOD", "WFMO", "CH", "AUTOS", "*RST", "RECA", "FAC",
+	};
+	size_t begin = 0;
+	while (begin < message.size()) {
+		size_t end = message.find(';', begin);
+		if (end == std::string_view::npos) end = message.size();
+		std::string_view command = message.substr(begin, end - begin);
+		while (!command.empty() && (command.front() == ':' || command.front() == ' ')) command.remove_prefix(1);
+		std::string_view header = command.substr(0, command.find(' '));
+		bool query = !header.empty() && header.back() == '?';
+		for (const char* prefix : prefixes) {
+			size_t n = std::char_traits<char>::length(prefix);
+			if (query || header.size() < n) continue;
+			bool match = true;
+			for (size_t i = 0; i < n && match; i++) match = std::toupper(static_cast<unsigned char>(header[i])) == prefix[i];
+			if (match) return true;
+		}
+		begin = end + 1;
+	}
+	return false;
+}
+
+class PreambleCache {
+public:
+	// preamble of the current settings, one WFMOutpre? round trip when it is not cached
+	// Returns 0 on success, 2 if the query can't be sent, 8 if the reply can't be parsed
+	int get(const ViSession& instr, ViUInt32& retCount, WaveformPreamble& preamble) {
+		if (!valid_) {
+			if (instrWrite(instr, "WFMOutpre?", retCount) != 0) return 2;
+			ViStatus status = transportRead(instr, reinterpret_cast<ViUInt8*>(reply_), sizeof(reply_), &retCount);
+			if (status == VI_SUCCESS_MAX_CNT) DiscardResponse(instr, retCount);
+			if (status < VI_SUCCESS || ParseWaveformPreamble(std::string_view(reply_, retCount), preamble_) != 0) return 8;
+			valid_ = true;
+			queries_++;
+		}
+		preamble = preamble_;
+		return 0;
+	}
+
+	// sends a command or program message, dropping the cached preamble if it affects it
+	int write(const ViSession& instr, std::string_view scpi, ViUInt32& retCount) {
+		if (AffectsPreamble(scpi)) valid_ = false;
+		return instrWrite(instr, scpi, retCount);
+	}
+
+	int flush(const ViSession& instr, ScpiBatch& batch, ViUInt32& retCount) {
+		if (AffectsPreamble(batch.message())) valid_ = false;
+		return batch.flush(instr, retCount);
+	}
+
+	void invalidate() { valid_ = false; }
+	bool valid() const { return valid_; }
+	size_t queries() const { return queries_; }
+
+private:
+	WaveformPreamble preamble_;
+	bool valid_ = false;
+	size_t queries_ = 0;
+	char reply_[4096];
+};
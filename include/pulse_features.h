@@ -0,0 +1,177 @@
+#pragma once
+
+// Online pulse analysis: a few numbers per event computed straight from the raw
+// int8/int16 samples, so long runs can be stored without keeping the waveforms.
+// Sums and extrema are taken in integer codes in one pass over the record (branch-free
+// reductions the compiler vectorizes); rise time and constant-fraction time only walk
+// the leading edge of the pulse. Codes are converted to volts once per event.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "convert.h"
+
+enum PulseFlags : uint32_t {
+	pulseSaturated = 1,		//peak sample at the end of the ADC range
+	pulseNotFound = 2,		//amplitude below the threshold, times are NaN
+};
+
+// Compact per-event record, written as is to the pulse file
+struct PulseFeatures {
+	uint64_t event;
+	float baseline;			//V, mean of the pre-trigger region
+	float noise;			//V rms of the pre-trigger region
+	float amplitude;		//V, peak height above the baseline (depth for negative polarity)
+	float peakTime;			//s
+	float riseTime;			//s, 10 % to 90 % of the amplitude
+	float cfdTime;			//s, leading edge crossing of cfdFraction * amplitude
+	float charge;			//C, integral of (v - baseline) / impedance over the window
+	uint32_t flags;
+};
+static_assert(sizeof(PulseFeatures) == 40, "PulseFeatures layout changed");
+
+struct PulseConfig {
+	size_t baselineEnd = 0;		//baseline from points [0, baselineEnd), must end before the pulse
+	size_t windowEnd = 0;		//peak search and charge from [baselineEnd, windowEnd), 0 = end of record
+	int polarity = 1;			//+1 positive pulses, -1 negative
+	double cfdFraction = 0.3;
+	double threshold = 5.0;		//pulse must exceed this many noise rms
+	double impedance = 50.0;	//ohm, for the charge
+};
+
+class PulseAnalyzer {
+public:
+	// time of point i is (i - pt_off) * xinc + xzero
+	PulseAnalyzer(const PulseConfig& config, const ConvertScale& scale, double xinc, double xzero, double pt_off)
+		: config_(config), scale_(scale), xinc_(xinc), xzero_(xzero), pt_off_(pt_off) {}
+
+	template<typename Sample>
+	PulseFeatures operator()(const Sample* samples, size_t n, uint64_t event) const {
+		PulseFeatures f;
+		std::memset(&f, 0, sizeof(f));
+		f.event = event;
+		size_t b = std::min(std::max<size_t>(config_.baselineEnd, 1), n);
+		size_t w = config_.windowEnd == 0 ? n : std::min(config_.windowEnd, n);
+		if (w <= b) w = n;
+
+		//single pass: baseline sums over the pre-trigger region, sum and extremes over the window
+		int64_t baseSum = 0, baseSquares = 0;
+		for (size_t i = 0; i < b; i++) {
+			int64_t s = samples[i];
+			baseSum += s;
+			baseSquares += s * s;
+		}
+		int64_t sum = 0;
+		int32_t hi = std::numeric_limits<int32_t>::min(), lo = std::numeric_limits<int32_t>::max();
+		for (size_t i = b; i < w; i++) {
+			int32_t s = samples[i];
+			sum += s;
+			hi = std::max(hi, s);
+			lo = std::min(lo, s);
+		}
+
+		double base = static_cast<double>(baseSum) / b;
+		double rms = std::sqrt(std::max(0.0, static_cast<double>(baseSquares) / b - base * base));
+		int32_t peak = config_.polarity > 0 ? hi : lo;
+		size_t iPeak = b;
+		while (iPeak < w && samples[iPeak] != peak) iPeak++;
+		double height = (peak - base) * config_.polarity;		//codes
+
+		double a = scale_.a();
+		f.baseline = static_cast<float>(base * a + scale_.b());
+		f.noise = static_cast<float>(rms * std::fabs(a));
+		f.amplitude = static_cast<float>(height * std::fabs(a));
+		f.peakTime = static_cast<float>(time(static_cast<double>(iPeak)));
+		f.charge = static_cast<float>((sum - base * (w - b)) * a * xinc_ / config_.impedance);
+		if (peak == std::numeric_limits<Sample>::max() || peak == std::numeric_limits<Sample>::min()) f.flags |= pulseSaturated;
+
+		if (height <= config_.threshold * std::max(rms, 0.5)) {
+			f.flags |= pulseNotFound;
+			f.riseTime = f.cfdTime = std::numeric_limits<float>::quiet_NaN();
+			return f;
+		}
+		double t10 = crossing(samples, b, iPeak, base, 0.1 * height);
+		double t90 = crossing(samples, b, iPeak, base, 0.9 * height);
+		f.riseTime = static_cast<float>((t90 - t10) * xinc_);
+		f.cfdTime = static_cast<float>(time(crossing(samples, b, iPeak, base, config_.cfdFraction * height)));
+		return f;
+	}
+
+	double time(double point) const { return (point - pt_off_) * xinc_ + xzero_; }
+
+private:
+	// fractional point where the leading edge crosses level (codes above baseline): walks back
+	// from the peak to the last sample below level and interpolates to the next one
+	template<typename Sample>
+	double crossing(const Sample* samples, size_t from, size_t iPeak, double base, double level) const {
+		size_t i = iPeak;
+		while (i > from && (samples[i - 1] - base) * config_.polarity >= level) i--;
+		if (i == from) return static_cast<double>(from);
+		double below = (samples[i - 1] - base) * config_.polarity;
+		double above = (samples[i] - base) * config_.polarity;
+		return (i - 1) + (level - below) / (above - below);
+	}
+
+	PulseConfig config_;
+	ConvertScale scale_;
+	double xinc_, xzero_, pt_off_;
+};
+
+static const char pulseFileMagic[8] = { 'M', 'S', 'O', '4', '4', 'P', 'L', 'S' };
+
+// Pulse file: 16 byte header (magic, version, record size) followed by PulseFeatures records
+class PulseFileWriter {
+public:
+	PulseFileWriter() = default;
+	PulseFileWriter(const PulseFileWriter&) = delete;
+	PulseFileWriter& operator=(const PulseFileWriter&) = delete;
+	~PulseFileWriter() { close(); }
+
+	bool open(const std::string& filename, size_t chunkRecords = 1 << 14) {
+		close();
+		file_ = std::fopen(filename.c_str(), "wb");
+		if (file_ == nullptr) {
+			printf("Error creating %s\n", filename.c_str());
+			return false;
+		}
+		uint32_t header[2] = { 1, sizeof(PulseFeatures) };
+		std::fwrite(pulseFileMagic, 1, sizeof(pulseFileMagic), file_);
+		std::fwrite(header, sizeof(header), 1, file_);
+		chunk_.clear();
+		chunk_.reserve(chunkRecords);
+		count_ = 0;
+		return true;
+	}
+
+	void append(const PulseFeatures& features) {
+		if (chunk_.size() == chunk_.capacity()) flush();
+		chunk_.push_back(features);
+		count_++;
+	}
+
+	void close() {
+		if (file_ == nullptr) return;
+		flush();
+		std::fclose(file_);
+		file_ = nullptr;
+	}
+
+	size_t records() const { return count_; }
+
+private:
+	void flush() {
+		if (chunk_.empty()) return;
+		std::fwrite(chunk_.data(), sizeof(PulseFeatures), chunk_.size(), file_);
+		chunk_.clear();
+	}
+
+	std::FILE* file_ = nullptr;
+	std::vector<PulseFeatures> chunk_;
+	size_t count_ = 0;
+};
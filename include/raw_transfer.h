@@ -0,0 +1,30 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include "visatype.h"
+#include "buffer_pool.h"
+
+// host stamps of one transfer, shared by all its frames
+struct TransferTiming {
+	using Clock = std::chrono::steady_clock;
+
+	Clock::time_point armed;		//scope ready to trigger: sequence armed, or previous readout done
+	Clock::time_point triggered;	//trigger seen by the host: poll, SRQ or *opc? reply
+	Clock::time_point readout;		//curve? data received
+};
+
+// One curve? transfer: a single event, or all frames of a FastFrame sequence.
+// Sample is ViInt8 for data:width 1 and int16_t for data:width 2 (SRIbinary, little endian)
+template<typename Sample>
+struct RawTransfer {
+	PooledBuffer<Sample>* buffer = nullptr;	//payload of the curve? block, without header and terminator
+	size_t recordLength = 0;
+	size_t nFrames = 0;
+	size_t firstEvent = 0;			//event number of frame 0, counting from 1
+	TransferTiming timing;
+	PooledBuffer<int64_t>* scopeTimes = nullptr;	//scope trigger timestamp of each frame in ns, if read
+
+	const Sample* frame(size_t k) const { return buffer->data + k * recordLength; }
+};
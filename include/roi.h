@@ -0,0 +1,131 @@
+#pragma once
+
+// Region-of-interest transfer: time windows on the waveform's x axis are turned into
+// data:start/data:stop sample ranges from the full-record preamble, so only those
+// samples cross the link. One window is set once for the run; several windows of the same
+// acquisition are read one after the other into one buffer, back to back.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "visa.h"
+#include "visatype.h"
+#include "vi_c2cpp.h"
+#include "ieee_block.h"
+#include "preamble.h"
+#include "scpi_command.h"
+
+// seconds on the preamble's time axis, 0 at the trigger
+struct TimeWindow {
+	double begin = 0;
+	double end = 0;
+};
+
+// 1-based inclusive point numbers, as data:start and data:stop take them, first 0 if empty
+struct SampleRange {
+	size_t first = 0;
+	size_t last = 0;
+
+	size_t size() const { return first > 0 && last >= first ? last - first + 1 : 0; }
+};
+
+// Points of the full record whose time falls inside window, clipped to the record.
+// Returns an empty range if the window lies outside the record.
+inline SampleRange RoiRange(const WaveformPreamble& full, const TimeWindow& window) {
+	if (full.nPoints == 0 || full.xinc <= 0 || window.end < window.begin) return {};
+	double first = std::ceil((window.begin - full.xzero) / full.xinc + full.pt_off);
+	double last = std::floor((window.end - full.xzero) / full.xinc + full.pt_off);
+	first = std::max(first, 0.0);
+	last = std::min(last, static_cast<double>(full.nPoints - 1));
+	if (last < first) return {};
+	return { static_cast<size_t>(first) + 1, static_cast<size_t>(last) + 1 };
+}
+
+// preamble of the points of range, the trigger offset counts from its first point
+inline WaveformPreamble RoiPreamble(const WaveformPreamble& full, const SampleRange& range) {
+	WaveformPreamble p = full;
+	p.nPoints = range.size();
+	p.pt_off = full.pt_off - static_cast<double>(range.first - 1);
+	return p;
+}
+
+// Sample ranges of a set of windows with their data:start/stop + curve? messages,
+// composed once before the run so the per-event path doesn't allocate.
+class RoiPlan {
+public:
+	// Returns 0 on success, 11 if a window selects no points of the record
+	int build(const WaveformPreamble& full, const std::vector<TimeWindow>& windows) {
+		full_ = full;
+		ranges_.clear();
+		commands_.clear();
+		points_ = 0;
+		for (const TimeWindow& window : windows) {
+			SampleRange range = RoiRange(full, window);
+			if (range.size() == 0) {
+				printf("Region of interest %g s to %g s selects no point of the record\n", window.begin, window.end);
+				return 11;
+			}
+			ranges_.push_back(range);
+			commands_.emplace_back(ScpiCommand<>("data:start ").add(range.first).add(";:data:stop ").add(range.last).add(";:").add(scpi::curve).view());
+			points_ += range.size();
+		}
+		return 0;
+	}
+
+	size_t size() const { return ranges_.size(); }
+	bool empty() const { return ranges_.empty(); }
+	const SampleRange& range(size_t k) const { return ranges_[k]; }
+	std::string_view readCommand(size_t k) const { return commands_[k]; }
+	size_t points() const { return points_; }	//all ranges together
+
+	// preamble of the first range, the one the pulse analysis runs on
+	WaveformPreamble preamble() const { return empty() ? full_ : RoiPreamble(full_, ranges_[0]); }
+
+	// time of every transferred point, ranges back to back
+	std::vector<double> times() const {
+		std::vector<double> t;
+		t.reserve(points_);
+		for (const SampleRange& range : ranges_) {
+			for (size_t point = range.first; point <= range.last; point++) t.push_back(full_.time(static_cast<double>(point - 1)));
+		}
+		return t;
+	}
+
+private:
+	WaveformPreamble full_;
+	std::vector<SampleRange> ranges_;
+	std::vector<std::string> commands_;
+	size_t points_ = 0;
+};
+
+// Reads every range of plan from the current, stopped acquisition into destination,
+// one data:start/stop;curve? round trip per range. nBytes is the total read.
+// Returns 0 on success, 11 if a range can't be selected or its block is short.
+inline int ReadRoiCurves(
+	const ViSession& instr,
+	const RoiPlan& plan,
+	void* destination,
+	size_t capacity,
+	size_t bytesPerPoint,
+	size_t& nBytes,
+	ViUInt32& retCount) {
+	nBytes = 0;
+	for (size_t k = 0; k < plan.size(); k++) {
+		size_t expected = plan.range(k).size() * bytesPerPoint;
+		if (nBytes + expected > capacity) {
+			printf("Region of interest buffer too small\n");
+			return 11;
+		}
+		size_t blockBytes = 0;
+		if (instrWrite(instr, plan.readCommand(k), retCount) != 0) return 11;
+		if (ReadIeeeBlock(instr, static_cast<char*>(destination) + nBytes, expected, blockBytes, retCount) != 0 || blockBytes != expected) {
+			printf("Short region of interest block: %zu of %zu bytes\n", blockBytes, expected);
+			return 11;
+		}
+		nBytes += blockBytes;
+	}
+	return 0;
+}
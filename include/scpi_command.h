@@ -0,0 +1,68 @@
+#pragma once
+
+// Allocation-free SCPI commands: the commands sent for every event are precomposed
+// literals, commands with numeric arguments are built in a fixed stack buffer with
+// std::to_chars. instrWrite/instrQuery take them as std::string_view.
+
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+
+// commands of the per-event path, sent as they are
+namespace scpi {
+inline constexpr std::string_view triggerState = "trigger:state?";
+inline constexpr std::string_view triggered = "TRIGGER\n";			//trigger:state? reply with header 0
+inline constexpr std::string_view curve = "curve?";
+inline constexpr std::string_view acquireAndWait = "acquire:state on;*opc?";	//FastFrame: one sequence, reply when complete
+inline constexpr std::string_view armSequence = "*cls;:acquire:state on;*opc";	//SRQ: clear ESR, start the sequence, *opc raises SRQ
+inline constexpr std::string_view frameTimestamps = "horizontal:fastframe:timestamp:all:ch2?";	//trigger time of every frame
+inline constexpr std::string_view acquisitionCount = "acquire:numacq?";
+inline constexpr std::string_view curveStream = "curvestream?";	//a curve? block per trigger until device clear
+}
+
+// Command text plus numeric arguments in a stack buffer, e.g.
+//   ScpiCommand<> cmd; cmd.add("data:stop ").add(recordLength);
+// A command that doesn't fit is reported once and sent truncated to its last complete part.
+template<size_t Capacity = 128>
+class ScpiCommand {
+public:
+	ScpiCommand() = default;
+	explicit ScpiCommand(std::string_view text) { add(text); }
+
+	ScpiCommand& add(std::string_view text) {
+		if (!fits(text.size())) return *this;
+		std::memcpy(data_ + size_, text.data(), text.size());
+		size_ += text.size();
+		return *this;
+	}
+
+	ScpiCommand& add(const char* text) { return add(std::string_view(text)); }
+
+	// integers as they are, floating point in the shortest form that reads back exactly
+	template<typename T, typename = std::enable_if_t<std::is_arithmetic_v<T> && !std::is_same_v<T, bool> && !std::is_same_v<T, char>>>
+	ScpiCommand& add(T value) {
+		auto result = std::to_chars(data_ + size_, data_ + Capacity, value);
+		if (result.ec != std::errc()) fits(Capacity);
+		else size_ = result.ptr - data_;
+		return *this;
+	}
+
+	void clear() { size_ = 0; }
+	bool empty() const { return size_ == 0; }
+	std::string_view view() const { return std::string_view(data_, size_); }
+	operator std::string_view() const { return view(); }
+
+private:
+	bool fits(size_t n) {
+		if (size_ + n <= Capacity) return true;
+		if (!overflow_) printf("SCPI command longer than %zu characters\n", Capacity);
+		overflow_ = true;
+		return false;
+	}
+
+	char data_[Capacity];
+	size_t size_ = 0;
+	bool overflow_ = false;
+};
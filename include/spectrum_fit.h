@@ -0,0 +1,69 @@
+#pragma once
+
+// Gaussian fit of the main peak of a spectrum filled by SharedHistogram, with curve_fit
+// from gsl-curve-fit. Used at the end of a run on the amplitude and charge spectra.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "histogram.h"
+#include "curve_fit.hpp"
+
+struct SpectrumPeak {
+	double height = 0;		//counts at the maximum
+	double mean = 0;
+	double sigma = 0;
+	size_t entries = 0;		//counts inside the fit window
+};
+
+// Fits height * exp(-(x - mean)^2 / (2 sigma^2)) to the bins within 3 sigma of the peak,
+// starting from the mean and rms of the whole spectrum (robust to empty bins when the bins
+// are narrower than the ADC step). counts as returned by SharedHistogram::snapshot().
+// Returns 0 on success, 7 if the peak has too few entries or the fit does not converge.
+inline int FitSpectrumPeak(const std::vector<uint64_t>& counts, const HistogramAxis& axis, SpectrumPeak& peak) {
+	const uint64_t* bins = counts.data() + 1;		//skip the underflow
+	double n = 0, sum = 0, squares = 0;
+	for (size_t b = 0; b < axis.bins; b++) {
+		double x = axis.center(b);
+		n += bins[b];
+		sum += bins[b] * x;
+		squares += bins[b] * x * x;
+	}
+	if (n < 10) {
+		printf("Spectrum peak has too few entries to fit\n");
+		return 7;
+	}
+	double mean = sum / n;
+	double sigma = std::max(std::sqrt(std::max(0.0, squares / n - mean * mean)), axis.width());
+	size_t begin = axis.index(mean - 3 * sigma);		//axis indices count the underflow, bin b is index b + 1
+	size_t end = std::min(axis.index(mean + 3 * sigma), axis.bins);
+	begin = begin > 0 ? begin - 1 : 0;
+	uint64_t height = 0;
+	for (size_t b = begin; b < end; b++) height = std::max(height, bins[b]);
+
+	std::vector<double> x, y;
+	peak.entries = 0;
+	for (size_t b = begin; b < end; b++) {
+		x.push_back(axis.center(b));
+		y.push_back(static_cast<double>(bins[b]));
+		peak.entries += bins[b];
+	}
+
+	auto gaussian = [](auto x, auto height, auto mean, auto sigma) {
+		auto z = (x - mean) / sigma;
+		return height * exp(-0.5 * z * z);
+	};
+	curve_fitter<decltype(gaussian)> fitter(gaussian);
+	std::vector<double> result = fitter.fit({ static_cast<double>(height), mean, sigma }, x, y);
+	if (fitter.stats().status != GSL_SUCCESS || !std::isfinite(result[2])) {
+		printf("Spectrum peak fit did not converge\n");
+		return 7;
+	}
+	peak.height = result[0];
+	peak.mean = result[1];
+	peak.sigma = std::fabs(result[2]);
+	return 0;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+// Bounded lock-free ring buffer for exactly one producer thread and one consumer thread.
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Waits for a ring to change without a lock: spin briefly, then sleep in short intervals
+inline void ringBackoff(unsigned& spins) {
+	if (++spins < 64) std::this_thread::yield();
+	else std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+
+template<typename T>
+class SpscRing {
+public:
+	// capacity is rounded up to a power of two
+	explicit SpscRing(size_t capacity) {
+		size_t n = 1;
+		while (n < capacity) n <<= 1;
+		slots_.resize(n);
+		mask_ = n - 1;
+	}
+
+	SpscRing(const SpscRing&) = delete;
+	SpscRing& operator=(const SpscRing&) = delete;
+
+	// producer side, false if the ring is full
+	bool tryPush(T&& item) {
+		size_t head = head_.load(std::memory_order_relaxed);
+		if (head - tailCache_ > mask_) {
+			tailCache_ = tail_.load(std::memory_order_acquire);
+			if (head - tailCache_ > mask_) return false;
+		}
+		slots_[head & mask_] = std::move(item);
+		head_.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	// consumer side, false if the ring is empty
+	bool tryPop(T& item) {
+		size_t tail = tail_.load(std::memory_order_relaxed);
+		if (tail == headCache_) {
+			headCache_ = head_.load(std::memory_order_acquire);
+			if (tail == headCache_) return false;
+		}
+		item = std::move(slots_[tail & mask_]);
+		tail_.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// number of queued items, exact only when called from the producer or consumer thread
+	size_t size() const {
+		return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+	}
+
+	size_t capacity() const { return mask_ + 1; }
+
+private:
+	static constexpr size_t cacheLine = 64;
+
+	std::vector<T> slots_;
+	size_t mask_;
+	//producer and consumer indices live on separate cache lines to avoid false sharing
+	alignas(cacheLine) std::atomic<size_t> head_{ 0 };
+	size_t tailCache_ = 0;				//producer's copy of tail_
+	alignas(cacheLine) std::atomic<size_t> tail_{ 0 };
+	size_t headCache_ = 0;				//consumer's copy of head_
+};
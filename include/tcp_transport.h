@@ -0,0 +1,548 @@
+#pragma once
+
+// Native TCP transports that bypass NI-VISA and its VXI-11 RPC framing:
+//   SocketTransport  raw SCPI socket (port 4000), messages end with '\n'
+//   HislipTransport  HiSLIP 1.0 (IVI-6.1, port 4880), synchronous and asynchronous
+//                    channel, 16 byte header per message, END and SRQ in the protocol
+// Both set TCP_NODELAY and large socket buffers and receive block payloads straight
+// into the caller's buffer.
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "Ws2_32.lib")
+#endif
+#else
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "transport.h"
+
+static const int tcpBufferSize = 4 << 20;		//SO_RCVBUF/SO_SNDBUF, a whole FastFrame block in flight
+
+class TcpSocket {
+public:
+#ifdef _WIN32
+	using Handle = SOCKET;
+	static constexpr Handle invalid = INVALID_SOCKET;
+#else
+	using Handle = int;
+	static constexpr Handle invalid = -1;
+#endif
+	static const long timedOut = -2;			//recvSome result when nothing arrived in time
+
+	TcpSocket() = default;
+	explicit TcpSocket(Handle handle) : handle_(handle) {}
+	~TcpSocket() { close(); }
+	TcpSocket(TcpSocket&& other) noexcept : handle_(other.handle_) { other.handle_ = invalid; }
+	TcpSocket& operator=(TcpSocket&& other) noexcept {
+		if (this != &other) {
+			close();
+			handle_ = other.handle_;
+			other.handle_ = invalid;
+		}
+		return *this;
+	}
+	TcpSocket(const TcpSocket&) = delete;
+	TcpSocket& operator=(const TcpSocket&) = delete;
+
+	static bool startup() {
+#ifdef _WIN32
+		static bool started = [] { WSADATA data; return WSAStartup(MAKEWORD(2, 2), &data) == 0; }();
+		return started;
+#else
+		return true;
+#endif
+	}
+
+	bool connect(const std::string& host, uint16_t port) {
+		if (!startup()) return false;
+		addrinfo hints{}, *addresses = nullptr;
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0) return false;
+		for (addrinfo* a = addresses; a != nullptr && handle_ == invalid; a = a->ai_next) {
+			handle_ = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+			if (handle_ == invalid) continue;
+			if (::connect(handle_, a->ai_addr, static_cast<int>(a->ai_addrlen)) != 0) close();
+		}
+		freeaddrinfo(addresses);
+		if (handle_ == invalid) return false;
+		tune();
+		return true;
+	}
+
+	// small commands leave at once, large buffers keep a full block in flight
+	void tune() {
+		int on = 1, size = tcpBufferSize;
+		setsockopt(handle_, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&on), sizeof(on));
+		setsockopt(handle_, SOL_SOCKET, SO_RCVBUF, reinterpret_cast<const char*>(&size), sizeof(size));
+		setsockopt(handle_, SOL_SOCKET, SO_SNDBUF, reinterpret_cast<const char*>(&size), sizeof(size));
+	}
+
+	bool sendAll(const void* data, size_t n) {
+		const char* p = static_cast<const char*>(data);
+		while (n > 0) {
+			long sent = static_cast<long>(::send(handle_, p, static_cast<int>(std::min<size_t>(n, 1 << 30)), sendFlags));
+			if (sent <= 0) return false;
+			p += sent;
+			n -= sent;
+		}
+		return true;
+	}
+
+	// true if data (or a close) arrives within timeoutMs, negative waits forever
+	bool waitReadable(int timeoutMs) {
+		pollfd fd{};
+		fd.fd = handle_;
+		fd.events = POLLIN;
+#ifdef _WIN32
+		return WSAPoll(&fd, 1, timeoutMs) > 0;
+#else
+		return ::poll(&fd, 1, timeoutMs) > 0;
+#endif
+	}
+
+	// bytes received, 0 if the peer closed, -1 on error, timedOut if nothing arrived in time
+	long recvSome(void* data, size_t n, int timeoutMs) {
+		if (!waitReadable(timeoutMs)) return timedOut;
+		long got = static_cast<long>(::recv(handle_, static_cast<char*>(data), static_cast<int>(std::min<size_t>(n, 1 << 30)), 0));
+		return got < 0 ? -1 : got;
+	}
+
+	bool recvAll(void* data, size_t n, int timeoutMs) {
+		char* p = static_cast<char*>(data);
+		while (n > 0) {
+			long got = recvSome(p, n, timeoutMs);
+			if (got <= 0) return false;
+			p += got;
+			n -= got;
+		}
+		return true;
+	}
+
+	void close() {
+		if (handle_ == invalid) return;
+#ifdef _WIN32
+		closesocket(handle_);
+#else
+		::close(handle_);
+#endif
+		handle_ = invalid;
+	}
+
+	bool valid() const { return handle_ != invalid; }
+	Handle handle() const { return handle_; }
+
+private:
+#ifdef MSG_NOSIGNAL
+	static const int sendFlags = MSG_NOSIGNAL;	//a closed peer is an error, not SIGPIPE
+#else
+	static const int sendFlags = 0;
+#endif
+	Handle handle_ = invalid;
+};
+
+// HiSLIP 1.0 message header and the message types used here
+namespace hislip {
+
+static const uint16_t defaultPort = 4880;
+static const uint32_t firstMessageId = 0xffffff00;
+static const uint16_t protocolVersion = 0x0100;
+static const size_t headerSize = 16;
+
+enum MessageType : uint8_t {
+	Initialize = 0, InitializeResponse = 1, FatalError = 2, Error = 3, Data = 6, DataEnd = 7,
+	DeviceClearComplete = 8, DeviceClearAcknowledge = 9, AsyncMaximumMessageSize = 15, AsyncMaximumMessageSizeResponse = 16,
+	AsyncInitialize = 17, AsyncInitializeResponse = 18, AsyncDeviceClear = 19, AsyncServiceRequest = 20,
+	AsyncStatusQuery = 21, AsyncStatusResponse = 22, AsyncDeviceClearAcknowledge = 23,
+};
+
+// "HS", type, control code, message parameter and payload length, big endian
+struct Header {
+	uint8_t type = 0;
+	uint8_t control = 0;
+	uint32_t parameter = 0;
+	uint64_t length = 0;
+};
+
+inline void encodeHeader(const Header& h, uint8_t* out) {
+	out[0] = 'H';
+	out[1] = 'S';
+	out[2] = h.type;
+	out[3] = h.control;
+	for (int i = 0; i < 4; i++) out[4 + i] = static_cast<uint8_t>(h.parameter >> (24 - 8 * i));
+	for (int i = 0; i < 8; i++) out[8 + i] = static_cast<uint8_t>(h.length >> (56 - 8 * i));
+}
+
+inline bool decodeHeader(const uint8_t* in, Header& h) {
+	if (in[0] != 'H' || in[1] != 'S') return false;
+	h.type = in[2];
+	h.control = in[3];
+	h.parameter = 0;
+	h.length = 0;
+	for (int i = 0; i < 4; i++) h.parameter = (h.parameter << 8) | in[4 + i];
+	for (int i = 0; i < 8; i++) h.length = (h.length << 8) | in[8 + i];
+	return true;
+}
+
+// header and payload in one send for commands, two for large payloads
+inline bool sendMessage(TcpSocket& socket, uint8_t type, uint8_t control, uint32_t parameter,
+	const void* payload, uint64_t length, std::vector<uint8_t>& scratch) {
+	Header h{ type, control, parameter, length };
+	if (length <= 64 * 1024) {
+		scratch.resize(headerSize + length);
+		encodeHeader(h, scratch.data());
+		if (length > 0) std::memcpy(scratch.data() + headerSize, payload, length);
+		return socket.sendAll(scratch.data(), scratch.size());
+	}
+	uint8_t header[headerSize];
+	encodeHeader(h, header);
+	return socket.sendAll(header, headerSize) && socket.sendAll(payload, length);
+}
+
+inline bool receiveHeader(TcpSocket& socket, Header& h, int timeoutMs) {
+	uint8_t header[headerSize];
+	return socket.recvAll(header, headerSize, timeoutMs) && decodeHeader(header, h);
+}
+
+} // namespace hislip
+
+// Raw SCPI over TCP: no END indicator, a read stops after '\n' (VI_SUCCESS_TERM_CHAR)
+// unless binaryMode is on, then it only stops when count bytes have arrived
+class SocketTransport : public Transport {
+public:
+	static const uint16_t defaultPort = 4000;
+
+	SocketTransport() : rx_(64 * 1024) { out_.reserve(1024); }	//commands reuse out_, no allocation per event
+
+	bool open(const std::string& host, uint16_t port) { return socket_.connect(host, port); }
+
+	ViStatus write(const ViUInt8* buf, ViUInt32 count, ViUInt32* retCount) override {
+		out_.assign(reinterpret_cast<const char*>(buf), count);
+		if (out_.empty() || out_.back() != '\n') out_.push_back('\n');	//the socket server executes on newline
+		if (retCount) *retCount = 0;
+		if (!socket_.sendAll(out_.data(), out_.size())) return VI_ERROR_CONN_LOST;
+		if (retCount) *retCount = count;
+		return VI_SUCCESS;
+	}
+
+	ViStatus read(ViUInt8* buf, ViUInt32 count, ViUInt32* retCount) override {
+		ViUInt32 n = 0;
+		if (retCount) *retCount = 0;
+		while (n < count) {
+			if (head_ == tail_) {
+				head_ = tail_ = 0;
+				if (binary_ && count - n >= rx_.size()) {
+					//large payload reads bypass the receive buffer
+					long got = socket_.recvSome(buf + n, count - n, timeout_);
+					if (got <= 0) return failed(got, n, retCount);
+					n += static_cast<ViUInt32>(got);
+					continue;
+				}
+				long got = socket_.recvSome(rx_.data(), rx_.size(), timeout_);
+				if (got <= 0) return failed(got, n, retCount);
+				tail_ = static_cast<size_t>(got);
+			}
+			size_t take = std::min<size_t>(count - n, tail_ - head_);
+			const void* newline = binary_ ? nullptr : std::memchr(rx_.data() + head_, '\n', take);
+			if (newline != nullptr) take = static_cast<const char*>(newline) - (rx_.data() + head_) + 1;
+			std::memcpy(buf + n, rx_.data() + head_, take);
+			head_ += take;
+			n += static_cast<ViUInt32>(take);
+			if (newline != nullptr) {
+				if (retCount) *retCount = n;
+				return VI_SUCCESS_TERM_CHAR;
+			}
+		}
+		if (retCount) *retCount = n;
+		return VI_SUCCESS_MAX_CNT;
+	}
+
+	ViStatus setTimeout(ViUInt32 ms) override {
+		timeout_ = ms == VI_TMO_INFINITE ? -1 : static_cast<int>(ms);
+		return VI_SUCCESS;
+	}
+
+	// no serial poll on a raw socket, *stb? is sent as a query instead
+	ViStatus readStb(ViUInt16* stb) override {
+		static const char query[] = "*stb?";
+		char reply[32];
+		ViUInt32 count = 0;
+		ViStatus status = write(reinterpret_cast<const ViUInt8*>(query), sizeof(query) - 1, &count);
+		if (status < VI_SUCCESS) return status;
+		status = read(reinterpret_cast<ViUInt8*>(reply), sizeof(reply) - 1, &count);
+		if (status < VI_SUCCESS) return status;
+		reply[count] = '\0';
+		*stb = static_cast<ViUInt16>(std::atoi(reply));
+		return VI_SUCCESS;
+	}
+
+	// drops buffered and in-flight response bytes until the line is quiet
+	ViStatus clear() override {
+		head_ = tail_ = 0;
+		while (socket_.recvSome(rx_.data(), rx_.size(), 50) > 0) {}
+		return VI_SUCCESS;
+	}
+
+	ViStatus enableSrq() override { return VI_ERROR_NSUP_OPER; }	//the raw socket has no service request
+	ViStatus disableSrq() override { return VI_SUCCESS; }
+	ViStatus waitForSrq(ViUInt32) override { return VI_ERROR_NSUP_OPER; }
+	void close() override { socket_.close(); }
+	void binaryMode(bool on) override { binary_ = on; }
+	TransportKind kind() const override { return TransportKind::Socket; }
+
+private:
+	static ViStatus failed(long got, ViUInt32 n, ViUInt32* retCount) {
+		if (retCount) *retCount = n;
+		return got == TcpSocket::timedOut ? VI_ERROR_TMO : VI_ERROR_CONN_LOST;
+	}
+
+	TcpSocket socket_;
+	std::vector<char> rx_;
+	size_t head_ = 0, tail_ = 0;
+	std::string out_;
+	int timeout_ = 2000;
+	bool binary_ = false;
+};
+
+// HiSLIP client in synchronized mode: commands go out as one DataEnd message, responses
+// are read message by message and END is the last byte of a DataEnd
+class HislipTransport : public Transport {
+public:
+	HislipTransport() { scratch_.reserve(hislip::headerSize + 1024); }
+
+	bool open(const std::string& host, uint16_t port, const std::string& subAddress) {
+		hislip::Header h;
+		if (!sync_.connect(host, port)) return false;
+		uint32_t client = (uint32_t(hislip::protocolVersion) << 16) | ('P' << 8) | 'C';
+		if (!hislip::sendMessage(sync_, hislip::Initialize, 0, client, subAddress.data(), subAddress.size(), scratch_)
+			|| !hislip::receiveHeader(sync_, h, timeout_) || h.type != hislip::InitializeResponse) return false;
+		uint32_t sessionId = h.parameter & 0xffff;
+		if (!async_.connect(host, port)
+			|| !hislip::sendMessage(async_, hislip::AsyncInitialize, 0, sessionId, nullptr, 0, scratch_)
+			|| !hislip::receiveHeader(async_, h, timeout_) || h.type != hislip::AsyncInitializeResponse) return false;
+		return true;
+	}
+
+	ViStatus write(const ViUInt8* buf, ViUInt32 count, ViUInt32* retCount) override {
+		if (retCount) *retCount = 0;
+		if (!hislip::sendMessage(sync_, hislip::DataEnd, rmtDelivered_ ? 1 : 0, messageId_, buf, count, scratch_)) return VI_ERROR_CONN_LOST;
+		rmtDelivered_ = false;
+		lastMessageId_ = messageId_;
+		messageId_ += 2;
+		if (retCount) *retCount = count;
+		return VI_SUCCESS;
+	}
+
+	ViStatus read(ViUInt8* buf, ViUInt32 count, ViUInt32* retCount) override {
+		ViUInt32 n = 0;
+		if (retCount) *retCount = 0;
+		while (true) {
+			if (!messageOpen_) {
+				hislip::Header h;
+				if (!hislip::receiveHeader(sync_, h, timeout_)) return VI_ERROR_TMO;
+				if (h.type != hislip::Data && h.type != hislip::DataEnd) {
+					discard(sync_, h.length);
+					if (h.type == hislip::Error || h.type == hislip::FatalError) return VI_ERROR_IO;
+					continue;
+				}
+				messageOpen_ = true;
+				remaining_ = h.length;
+				end_ = h.type == hislip::DataEnd;
+			}
+			size_t take = static_cast<size_t>(std::min<uint64_t>(count - n, remaining_));
+			if (take > 0 && !sync_.recvAll(buf + n, take, timeout_)) {
+				if (retCount) *retCount = n;
+				return VI_ERROR_TMO;
+			}
+			n += static_cast<ViUInt32>(take);
+			remaining_ -= take;
+			if (remaining_ == 0) messageOpen_ = false;
+			if (remaining_ == 0 && end_) {
+				rmtDelivered_ = true;
+				if (retCount) *retCount = n;
+				return VI_SUCCESS;
+			}
+			if (n == count) {
+				if (retCount) *retCount = n;
+				return VI_SUCCESS_MAX_CNT;
+			}
+		}
+	}
+
+	ViStatus setTimeout(ViUInt32 ms) override {
+		timeout_ = ms == VI_TMO_INFINITE ? -1 : static_cast<int>(ms);
+		return VI_SUCCESS;
+	}
+
+	ViStatus readStb(ViUInt16* stb) override {
+		if (!hislip::sendMessage(async_, hislip::AsyncStatusQuery, rmtDelivered_ ? 1 : 0, lastMessageId_, nullptr, 0, scratch_)) return VI_ERROR_CONN_LOST;
+		hislip::Header h;
+		if (!receiveAsync(hislip::AsyncStatusResponse, h)) return VI_ERROR_TMO;
+		*stb = h.control;
+		return VI_SUCCESS;
+	}
+
+	// IVI-6.1 device clear: AsyncDeviceClear, then DeviceClearComplete on the synchronous
+	// channel, dropping every response that is still on its way
+	ViStatus clear() override {
+		hislip::Header h;
+		if (!hislip::sendMessage(async_, hislip::AsyncDeviceClear, 0, 0, nullptr, 0, scratch_)) return VI_ERROR_CONN_LOST;
+		if (!receiveAsync(hislip::AsyncDeviceClearAcknowledge, h)) return VI_ERROR_TMO;
+		if (messageOpen_) discard(sync_, remaining_);
+		messageOpen_ = false;
+		remaining_ = 0;
+		if (!hislip::sendMessage(sync_, hislip::DeviceClearComplete, h.control, 0, nullptr, 0, scratch_)) return VI_ERROR_CONN_LOST;
+		do {
+			if (!hislip::receiveHeader(sync_, h, timeout_)) return VI_ERROR_TMO;
+			if (h.type != hislip::DeviceClearAcknowledge) discard(sync_, h.length);
+		} while (h.type != hislip::DeviceClearAcknowledge);
+		messageId_ = hislip::firstMessageId;
+		rmtDelivered_ = false;
+		return VI_SUCCESS;
+	}
+
+	// service requests always arrive on the asynchronous channel, drop the stale ones
+	ViStatus enableSrq() override {
+		hislip::Header h;
+		srqPending_ = false;
+		while (async_.waitReadable(0) && hislip::receiveHeader(async_, h, timeout_)) discard(async_, h.length);
+		return VI_SUCCESS;
+	}
+
+	ViStatus disableSrq() override { return VI_SUCCESS; }
+
+	ViStatus waitForSrq(ViUInt32 timeout) override {
+		hislip::Header h;
+		if (srqPending_) {
+			srqPending_ = false;
+			return VI_SUCCESS;
+		}
+		int ms = timeout == VI_TMO_INFINITE ? -1 : static_cast<int>(timeout);
+		while (async_.waitReadable(ms)) {
+			if (!hislip::receiveHeader(async_, h, timeout_)) return VI_ERROR_CONN_LOST;
+			discard(async_, h.length);
+			if (h.type == hislip::AsyncServiceRequest) return VI_SUCCESS;
+		}
+		return VI_ERROR_TMO;
+	}
+
+	void close() override {
+		async_.close();
+		sync_.close();
+	}
+
+	TransportKind kind() const override { return TransportKind::Hislip; }
+
+private:
+	// next asynchronous message of the given type, a service request on the way is remembered
+	bool receiveAsync(uint8_t type, hislip::Header& h) {
+		while (hislip::receiveHeader(async_, h, timeout_)) {
+			discard(async_, h.length);
+			if (h.type == type) return true;
+			if (h.type == hislip::AsyncServiceRequest) srqPending_ = true;
+		}
+		return false;
+	}
+
+	bool discard(TcpSocket& socket, uint64_t n) {
+		char sink[4096];
+		while (n > 0) {
+			size_t take = static_cast<size_t>(std::min<uint64_t>(n, sizeof(sink)));
+			if (!socket.recvAll(sink, take, timeout_)) return false;
+			n -= take;
+		}
+		return true;
+	}
+
+	TcpSocket sync_, async_;
+	std::vector<uint8_t> scratch_;
+	uint32_t messageId_ = hislip::firstMessageId;
+	uint32_t lastMessageId_ = hislip::firstMessageId - 2;
+	bool rmtDelivered_ = false;		//a complete response was read since the last command
+	bool messageOpen_ = false;
+	bool end_ = false;
+	uint64_t remaining_ = 0;
+	bool srqPending_ = false;
+	int timeout_ = 2000;
+};
+
+// host, port and HiSLIP sub-address of a VISA TCPIP resource string:
+// TCPIP0::host::inst0::INSTR, TCPIP0::host::4000::SOCKET, TCPIP0::host::hislip0[,port]::INSTR
+struct TcpResource {
+	std::string host;
+	uint16_t port = 0;			//0 = default port of the transport
+	std::string device = "hislip0";
+};
+
+inline bool ParseTcpResource(const std::string& resource, TcpResource& r) {
+	std::vector<std::string> fields;
+	for (size_t begin = 0; begin <= resource.size();) {
+		size_t end = resource.find("::", begin);
+		if (end == std::string::npos) end = resource.size();
+		fields.push_back(resource.substr(begin, end - begin));
+		begin = end + 2;
+	}
+	if (fields.size() < 2 || fields[0].size() < 5) return false;
+	for (size_t i = 0; i < 5; i++) {
+		if (std::toupper(static_cast<unsigned char>(fields[0][i])) != "TCPIP"[i]) return false;
+	}
+	r.host = fields[1];
+	if (fields.size() < 3 || fields[2] == "INSTR" || fields[2] == "SOCKET") return true;
+	std::string device = fields[2];
+	size_t comma = device.find(',');
+	if (comma != std::string::npos) {
+		r.port = static_cast<uint16_t>(std::atoi(device.c_str() + comma + 1));
+		device.resize(comma);
+	}
+	if (!device.empty() && device.find_first_not_of("0123456789") == std::string::npos) r.port = static_cast<uint16_t>(std::atoi(device.c_str()));
+	else if (device.compare(0, 6, "hislip") == 0) r.device = device;
+	return true;
+}
+
+// Connects without VISA to the host of resourceString and registers the transport under a new
+// session handle in instr. Returns 0 on success, 1 if the resource or the connection fails.
+inline int OpenNativeTransport(TransportKind kind, const std::string& resourceString, ViUInt32 timeout, ViSession& instr) {
+	TcpResource resource;
+	if (!ParseTcpResource(resourceString, resource)) {
+		printf("%s is not a TCPIP resource\n", resourceString.c_str());
+		return 1;
+	}
+	if (timeout == 0) timeout = 2000;		//VI_NULL, the VISA default
+	std::unique_ptr<Transport> transport;
+	if (kind == TransportKind::Socket) {
+		auto socket = std::make_unique<SocketTransport>();
+		if (socket->open(resource.host, resource.port != 0 ? resource.port : SocketTransport::defaultPort)) transport = std::move(socket);
+	}
+	else {
+		auto session = std::make_unique<HislipTransport>();
+		if (session->setTimeout(timeout) >= VI_SUCCESS && session->open(resource.host, resource.port != 0 ? resource.port : hislip::defaultPort, resource.device)) {
+			transport = std::move(session);
+		}
+	}
+	if (!transport) {
+		printf("Error connecting to %s over %s\n", resource.host.c_str(), transportKindName(kind));
+		return 1;
+	}
+	transport->setTimeout(timeout);
+	instr = nextNativeSession();
+	registerTransport(instr, std::move(transport));
+	return 0;
+}
@@ -0,0 +1,175 @@
+#pragma once
+
+// Byte transport between the acquisition code and the scope. instrWrite/instrRead/
+// ReadIeeeBlock and the SRQ helpers go through the Transport registered for the
+// session, so the same code runs over NI-VISA, a raw SCPI socket or HiSLIP
+// (tcp_transport.h). Sessions without a registered transport are plain VISA sessions.
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "visa.h"
+#include "visatype.h"
+
+enum class TransportKind { Visa, Socket, Hislip };
+
+inline const char* transportKindName(TransportKind kind) {
+	switch (kind) {
+	case TransportKind::Socket: return "socket";
+	case TransportKind::Hislip: return "hislip";
+	default: return "visa";
+	}
+}
+
+inline bool parseTransportKind(const std::string& name, TransportKind& kind) {
+	if (name == "visa") kind = TransportKind::Visa;
+	else if (name == "socket") kind = TransportKind::Socket;
+	else if (name == "hislip") kind = TransportKind::Hislip;
+	else return false;
+	return true;
+}
+
+// Same contract as the VISA calls they replace: read returns VI_SUCCESS at the end of a
+// response message, VI_SUCCESS_MAX_CNT when count bytes arrived first and
+// VI_SUCCESS_TERM_CHAR at a '\n' when the transport has no message framing (raw socket)
+class Transport {
+public:
+	virtual ~Transport() = default;
+
+	virtual ViStatus write(const ViUInt8* buf, ViUInt32 count, ViUInt32* retCount) = 0;
+	virtual ViStatus read(ViUInt8* buf, ViUInt32 count, ViUInt32* retCount) = 0;
+	virtual ViStatus setTimeout(ViUInt32 ms) = 0;
+	virtual ViStatus readStb(ViUInt16* stb) = 0;
+	virtual ViStatus clear() = 0;				//device clear, drops pending responses
+	virtual ViStatus enableSrq() = 0;
+	virtual ViStatus disableSrq() = 0;
+	virtual ViStatus waitForSrq(ViUInt32 timeout) = 0;
+	virtual void close() = 0;
+
+	// while on, reads of a binary payload don't stop at '\n', no-op for framed transports
+	virtual void binaryMode(bool) {}
+
+	virtual TransportKind kind() const = 0;
+};
+
+class VisaTransport : public Transport {
+public:
+	explicit VisaTransport(ViSession instr) : instr_(instr) {}
+
+	ViStatus write(const ViUInt8* buf, ViUInt32 count, ViUInt32* retCount) override { return viWrite(instr_, buf, count, retCount); }
+	ViStatus read(ViUInt8* buf, ViUInt32 count, ViUInt32* retCount) override { return viRead(instr_, buf, count, retCount); }
+	ViStatus setTimeout(ViUInt32 ms) override { return viSetAttribute(instr_, VI_ATTR_TMO_VALUE, ms); }
+	ViStatus readStb(ViUInt16* stb) override { return viReadSTB(instr_, stb); }
+	ViStatus clear() override { return viClear(instr_); }
+	ViStatus enableSrq() override { return viEnableEvent(instr_, VI_EVENT_SERVICE_REQ, VI_QUEUE, VI_NULL); }
+	ViStatus disableSrq() override { return viDisableEvent(instr_, VI_EVENT_SERVICE_REQ, VI_QUEUE); }
+
+	ViStatus waitForSrq(ViUInt32 timeout) override {
+		ViEventType eventType;
+		ViEvent event;
+		ViStatus status = viWaitOnEvent(instr_, VI_EVENT_SERVICE_REQ, timeout, &eventType, &event);
+		if (status >= VI_SUCCESS) viClose(event);
+		return status;
+	}
+
+	void close() override { viClose(instr_); }
+	TransportKind kind() const override { return TransportKind::Visa; }
+
+private:
+	ViSession instr_;
+};
+
+// transports by session handle, native sessions get handles from a range of their own
+inline std::vector<std::pair<ViSession, std::unique_ptr<Transport>>>& transportSessions() {
+	static std::vector<std::pair<ViSession, std::unique_ptr<Transport>>> sessions;
+	return sessions;
+}
+
+inline Transport* findTransport(ViSession instr) {
+	for (auto& session : transportSessions()) {
+		if (session.first == instr) return session.second.get();
+	}
+	return nullptr;
+}
+
+inline void registerTransport(ViSession instr, std::unique_ptr<Transport> transport) {
+	transportSessions().emplace_back(instr, std::move(transport));
+}
+
+inline ViSession nextNativeSession() {
+	static ViSession next = 0x7e000000;
+	while (findTransport(next) != nullptr) next++;
+	return next++;
+}
+
+// closes the session and forgets its transport
+inline void closeTransport(ViSession instr) {
+	auto& sessions = transportSessions();
+	auto it = std::find_if(sessions.begin(), sessions.end(), [&](const auto& s) { return s.first == instr; });
+	if (it == sessions.end()) {
+		viClose(instr);
+		return;
+	}
+	it->second->close();
+	sessions.erase(it);
+}
+
+inline ViStatus transportWrite(ViSession instr, const ViUInt8* buf, ViUInt32 count, ViUInt32* retCount) {
+	if (Transport* t = findTransport(instr)) return t->write(buf, count, retCount);
+	return viWrite(instr, buf, count, retCount);
+}
+
+inline ViStatus transportRead(ViSession instr, ViUInt8* buf, ViUInt32 count, ViUInt32* retCount) {
+	if (Transport* t = findTransport(instr)) return t->read(buf, count, retCount);
+	return viRead(instr, buf, count, retCount);
+}
+
+inline ViStatus transportSetTimeout(ViSession instr, ViUInt32 ms) {
+	if (Transport* t = findTransport(instr)) return t->setTimeout(ms);
+	return viSetAttribute(instr, VI_ATTR_TMO_VALUE, ms);
+}
+
+inline ViStatus transportReadStb(ViSession instr, ViUInt16* stb) {
+	if (Transport* t = findTransport(instr)) return t->readStb(stb);
+	return viReadSTB(instr, stb);
+}
+
+inline ViStatus transportClear(ViSession instr) {
+	if (Transport* t = findTransport(instr)) return t->clear();
+	return viClear(instr);
+}
+
+inline ViStatus transportEnableSrq(ViSession instr) {
+	if (Transport* t = findTransport(instr)) return t->enableSrq();
+	return viEnableEvent(instr, VI_EVENT_SERVICE_REQ, VI_QUEUE, VI_NULL);
+}
+
+inline ViStatus transportDisableSrq(ViSession instr) {
+	if (Transport* t = findTransport(instr)) return t->disableSrq();
+	return viDisableEvent(instr, VI_EVENT_SERVICE_REQ, VI_QUEUE);
+}
+
+inline ViStatus transportWaitForSrq(ViSession instr, ViUInt32 timeout) {
+	if (Transport* t = findTransport(instr)) return t->waitForSrq(timeout);
+	VisaTransport visa(instr);
+	return visa.waitForSrq(timeout);
+}
+
+// binary mode for the lifetime of the scope, e.g. around an IEEE block payload
+class BinaryReadScope {
+public:
+	explicit BinaryReadScope(ViSession instr) : transport_(findTransport(instr)) {
+		if (transport_ != nullptr) transport_->binaryMode(true);
+	}
+	~BinaryReadScope() {
+		if (transport_ != nullptr) transport_->binaryMode(false);
+	}
+	BinaryReadScope(const BinaryReadScope&) = delete;
+	BinaryReadScope& operator=(const BinaryReadScope&) = delete;
+
+private:
+	Transport* transport_;
+};
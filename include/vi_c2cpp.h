@@ -1,10 +1,15 @@
 #pragma once
 
 #include <iostream>
+#include <string_view>
 
 #include "visa.h"
 #include "visatype.h"
 #include "casts.h"
+#include "latency.h"
+#include "transport.h"
+#include "tcp_transport.h"
+#include "scpi_command.h"
 
 int InitVisaSession(ViSession& defaultRM) {
 	ViStatus status;
@@ -20,15 +25,22 @@ int InitVisaSession(ViSession& defaultRM) {
 	return 0;
 }
 
+//transport selects NI-VISA or a native raw socket or HiSLIP connection to the host of resourceString
 int ConnectToInstrument(
 	ViSession& defaultRM, 
 	const std::string& resourceString, 
 	const ViUInt32& access_mode,
 	const ViUInt32& timeout,
 	ViSession& instr, 
-	ViChar* buffer){
+	ViChar* buffer,
+	TransportKind transport = TransportKind::Visa){
 
 	ViStatus status;
+	if (transport != TransportKind::Visa) {
+		if (OpenNativeTransport(transport, resourceString, timeout, instr) != 0) return 1;
+		std::cout << "Instrument initialized successfuly over " << transportKindName(transport) << '\n';
+		return 0;
+	}
 	status = viOpen(defaultRM, resourceString.c_str(), VI_NULL, VI_NULL, &instr);
 	if (status < VI_SUCCESS) {
 		std::cout << "Error connecting to instrument\nPress 0 and hit ENTER to quit\n";
@@ -40,12 +52,15 @@ int ConnectToInstrument(
 	else {
 		std::cout << "Instrument initialized successfuly\n";
 	}
+	registerTransport(instr, std::make_unique<VisaTransport>(instr));
 	return 0;
 }
 
-int instrWrite(const ViSession& instr, std::string& scpi, ViUInt32& retCount) {
+//string literals, std::string and ScpiCommand all pass as a view, nothing is copied
+int instrWrite(const ViSession& instr, std::string_view scpi, ViUInt32& retCount) {
+	LatencyTimer timer(LatencyStage::Write);
 	ViStatus status;
-	status = viWrite(instr,  str_to_uch(scpi), scpi.size(), &retCount);
+	status = transportWrite(instr, sv_to_conuch(scpi), static_cast<ViUInt32>(scpi.size()), &retCount);
 	if (status < VI_SUCCESS) {
 		printf("Error writing to instrument\n");
 		return 2;
@@ -53,16 +68,12 @@ int instrWrite(const ViSession& instr, std::string& scpi, ViUInt32& retCount) {
 	else return 0;
 }
 
-void instrWrite(const ViSession& instr, const char* command, ViUInt32& retCount) {
-	std::string scpi (command);
-	instrWrite(instr, scpi, retCount);
-}
-
 ViChar* instrRead(const ViSession& instr, ViChar* buffer, ViUInt32& retCount) {
 	ViStatus status;
 	ViUInt32 sbuf = 1024*1024;
+	LatencyTimer timer(LatencyStage::Read);
 
-	status = viRead(instr, reinterpret_cast<unsigned char*>(buffer), sbuf, &retCount);
+	status = transportRead(instr, reinterpret_cast<unsigned char*>(buffer), sbuf, &retCount);
 	if (status < VI_SUCCESS) {
 		printf("Error reading from instrument\n");
 		return buffer;
@@ -70,14 +81,78 @@ ViChar* instrRead(const ViSession& instr, ViChar* buffer, ViUInt32& retCount) {
 	else return buffer;
 }
 
-ViChar* instrQuery(const ViSession& instr, std::string& scpi, ViUInt32& retCount, ViChar* buffer) {
-	ViStatus status;
+ViChar* instrQuery(const ViSession& instr, std::string_view scpi, ViUInt32& retCount, ViChar* buffer) {
+	LatencyTimer timer(LatencyStage::Query);		//write and read are also counted on their own
 	instrWrite(instr, scpi, retCount);
 	instrRead(instr, buffer, retCount);
 	return buffer;
 }
 
-ViChar* instrQuery(const ViSession& instr, const char* command, ViUInt32& retCount, ViChar* buffer) {
-	std::string scpi (command);
-	return instrQuery(instr, scpi, retCount, buffer);
+//joins several commands into one ';'-separated program message sent with a single viWrite,
+//commands from another subsystem get a leading ':' so each one keeps its full header path
+class ScpiBatch {
+public:
+	ScpiBatch& add(std::string_view command) {
+		if (!message_.empty()) {
+			message_ += ';';
+			if (!command.empty() && command[0] != ':' && command[0] != '*') message_ += ':';
+		}
+		message_ += command;
+		return *this;
+	}
+
+	//send all queued commands at once and start a new batch, the buffer is kept for reuse
+	int flush(const ViSession& instr, ViUInt32& retCount) {
+		int status = 0;
+		if (!message_.empty()) status = instrWrite(instr, message_, retCount);
+		message_.clear();
+		return status;
+	}
+
+	bool empty() const { return message_.empty(); }
+	const std::string& message() const { return message_; }
+
+private:
+	std::string message_;
+};
+
+//service request on operation complete: *OPC sets ESR bit 0, *ESE 1 maps it to the
+//ESB summary bit of the status byte and *SRE 32 raises SRQ when ESB is set
+int EnableSrqOnOpc(const ViSession& instr, ViUInt32& retCount) {
+	ViStatus status;
+	ScpiBatch batch;
+	batch.add("*cls").add("*ese 1").add("*sre 32").flush(instr, retCount);
+	status = transportEnableSrq(instr);
+	if (status < VI_SUCCESS) {
+		printf("Error enabling service requests\n");
+		return 4;
+	}
+	return 0;
+}
+
+void DisableSrq(const ViSession& instr, ViUInt32& retCount) {
+	ScpiBatch batch;
+	transportDisableSrq(instr);
+	batch.add("*sre 0").add("*cls").flush(instr, retCount);
+}
+
+//arm a single sequence and sleep in viWaitOnEvent until the scope reports it complete,
+//no queries are sent while waiting; requires acquire:stopafter sequence and EnableSrqOnOpc
+//returns 5 if no trigger came within timeout, 4 if the service request can't be waited for
+int WaitForAcquisition(const ViSession& instr, ViUInt32 timeout, ViUInt32& retCount) {
+	ViStatus status;
+	ViUInt16 stb;
+	//clear ESR so the next *OPC raises a new SRQ, then start the sequence
+	instrWrite(instr, scpi::armSequence, retCount);
+	status = transportWaitForSrq(instr, timeout);
+	if (status == VI_ERROR_TMO) {
+		printf("Timeout waiting for acquisition\n");
+		return 5;
+	}
+	if (status < VI_SUCCESS) {
+		printf("Error waiting for service request\n");
+		return 4;
+	}
+	transportReadStb(instr, &stb);						//serial poll clears the request
+	return 0;
 }
@@ -4,16 +4,34 @@
 #define _CRT_SECURE_NO_WARNINGS
 
 #include <string>
+#include <string_view>
 #include <cstdint>
+#include <algorithm>
 #include <vector>
 #include <fstream>
 #include <iomanip>
 #include <filesystem>
+#include <chrono>
 
 #include "visa.h"
 #include "visatype.h"
 #include "casts.h"
 #include "vi_c2cpp.h"
+#include "fastframe.h"
+#include "curve_stream.h"
+#include "event_file.h"
+#include "pipeline.h"
+#include "convert.h"
+#include "csv_writer.h"
+#include "ieee_block.h"
+#include "pulse_features.h"
+#include "decimate.h"
+#include "histogram.h"
+#include "spectrum_fit.h"
+#include "preamble.h"
+#include "latency.h"
+#include "event_timing.h"
+#include "roi.h"
 
 int main() {
 
@@ -23,54 +41,94 @@ int main() {
 	ViChar buffer[80000];
 	int recordLength, pt_off;
 	double xinc, xzero, ymult, yzero, yoff;
-	int triggered;
+	PreambleCache preambleCache;	//WFMOutpre? is only sent again after a command that changes the preamble
+	WaveformPreamble preamble;
+	size_t triggered;
 	size_t nEvents;
+	size_t nFrames = 1;		//FastFrame: events captured per bulk transfer, 1 = one curve? per event
+	bool useSrq = false;	//wait for each event with a service request instead of polling trigger:state?
+	bool useCurveStream = false;	//CURVEStream?: the scope pushes every waveform as it triggers, no re-arm or query per event
+	bool binaryOutput = false;	//store raw samples of all events in run.evt instead of data_N.csv files
+	size_t queueDepth = 64;	//transfers buffered between readout, decode and storage threads
+	size_t poolBudget = 1 << 30;	//bytes of waveform buffers preallocated for the run, caps transfers in flight
+	bool hugePages = true;	//back waveform buffers with 2 MB pages when the OS provides them
+	int csvPrecision = 5;	//significant digits of time and voltage in data_N.csv
+	int sampleWidth = 1;	//data:width in bytes, 2 keeps the full resolution of high res acquisition
+	bool extractFeatures = false;	//per-event baseline, amplitude, rise time, cfd time and charge in pulses.dat
+	bool storeWaveforms = true;	//false keeps only the pulse features of each event, no csv or run.evt
+	DecimateMode decimateMode = DecimateMode::MinMax;	//reduction of long records in data_N.csv: MinMax keeps the peaks, Lttb the shape, None all points
+	size_t targetPoints = 20000;	//points per data_N.csv file when decimating
+	bool buildSpectra = true;	//with extractFeatures: amplitude and charge spectra filled as events arrive, fitted at the end
+	HistogramAxis amplitudeAxis{ 1000, 0.0, 0.5 };	//bins, V
+	HistogramAxis chargeAxis{ 1000, 0.0, 200e-12 };	//bins, C
+	double checkpointInterval = 30;	//s between spectrum_*.csv checkpoints during the run
+	bool recordTiming = true;	//scope and host trigger stamps of each event in timing.csv, live and dead time at the end
+	std::vector<TimeWindow> roiWindows;	//s from the trigger, e.g. { { -20e-9, 200e-9 } }: only these samples are transferred, empty = whole record
 
 	// Address of the oscilloscope, TCPIP or USB
 	std::string resourceString = "TCPIP0::192.168.0.200::inst0::INSTR";
+	TransportKind transport = TransportKind::Visa;	//Socket (port 4000) or Hislip talk to the scope over TCP directly instead of through NI-VISA
 	std::string scpi;
 
 	// Initialize VISA session, if any errors, quit the program
 	if (InitVisaSession(defaultRM) != 0) return 0;
 	// Open instrument connection, if any errors, quit the program
-	if (ConnectToInstrument(defaultRM, resourceString, VI_NULL, VI_NULL, instr, buffer) != 0) return 0;
+	if (ConnectToInstrument(defaultRM, resourceString, VI_NULL, VI_NULL, instr, buffer, transport) != 0) return 0;
 	// Set timeout for queries/reading
-	status = viSetAttribute(instr, VI_ATTR_TMO_VALUE, 10000);
+	status = transportSetTimeout(instr, 10000);
 
 	//Check if the connection to the instrument is established
 	instrQuery(instr, "*idn?", retCount, buffer);
 	std::cout << buffer << '\n';
-	//set oscilloscope initial settings
-	instrWrite(instr, "header 0", retCount);			//turn off headers for queries, so only arguments are returned
-	instrWrite(instr, "data:source ch2", retCount);		//data from CH2 of osc
-	instrWrite(instr, "data:enc sri", retCount);		//encoding of data SRIbinary (see specifications)
-	instrWrite(instr, "data:width 1", retCount);		//data pieces are 1 byte wide
-
-	instrWrite(instr, "data:start 1", retCount);		//starting data point
-	instrWrite(instr, "data:stop 1e10", retCount);		//ending data point
-	viSetAttribute(instr, VI_ATTR_TERMCHAR, '\r');		//termination char for output
-
-	recordLength = atoi(instrQuery(instr, "WFMOutpre:NR_Pt?", retCount, buffer));	//number of points in waveform
-	scpi = "data:stop " + std::to_string(recordLength);								//set proper ending data point
-	instrWrite(instr, scpi, retCount);												//write it into osc
-
-	//values necessary to reconstruct waveform: starting/ending/step of x,y
-	xinc = std::atof(instrQuery(instr, "WFMOutpre:XINcr?", retCount, buffer));
-	xzero = std::atof(instrQuery(instr, "WFMOutpre:XZERO?", retCount, buffer));
-	pt_off = std::atof(instrQuery(instr, "WFMOutpre:PT_OFF?", retCount, buffer));
-	
-	ymult = std::atof(instrQuery(instr, "WFMOutpre:YMULT?", retCount, buffer));
-	yzero = std::atof(instrQuery(instr, "WFMOutpre:YZERO?", retCount, buffer));
-	yoff = std::atof(instrQuery(instr, "WFMOutpre:YOFF?", retCount, buffer));
+	//set oscilloscope initial settings, all sent in one write
+	ScpiBatch batch;
+	batch.add("header 0");				//turn off headers for queries, so only arguments are returned
+	batch.add("data:source ch2");		//data from CH2 of osc
+	batch.add("data:enc sri");			//SRIbinary: signed, least significant byte first, 2 byte samples are used in place
+	batch.add(ScpiCommand<>("data:width ").add(sampleWidth));	//data pieces are 1 or 2 bytes wide
+	batch.add("data:start 1");			//starting data point
+	batch.add("data:stop 1e10");		//ending data point, the scope clips it to the record length
+	preambleCache.flush(instr, batch, retCount);
+	if (transport == TransportKind::Visa) viSetAttribute(instr, VI_ATTR_TERMCHAR, '\r');		//termination char for output, native sessions are no VISA objects
+
+	//values necessary to reconstruct waveform: number of points, starting/step of x,y, all from one WFMOutpre? query
+	if (preambleCache.get(instr, retCount, preamble) != 0) return 0;
+	//region of interest: sample ranges of the windows in the full record, one range is selected
+	//once for the run, several are read one after the other from each stopped acquisition
+	RoiPlan roi;
+	if (roi.build(preamble, roiWindows) != 0) return 0;
+	if (roi.size() == 1) {
+		preambleCache.write(instr, ScpiCommand<>("data:start ").add(roi.range(0).first).add(";:data:stop ").add(roi.range(0).last), retCount);
+	}
+	else if (roi.size() > 1) {
+		if (transport == TransportKind::Socket) {
+			std::cout << "Several regions of interest need service requests, a raw socket has none\n";
+			return 0;
+		}
+		nFrames = 1;				//all ranges must come from the same waveform: single sequence, one event at a time
+		useCurveStream = false;
+		useSrq = true;
+		binaryOutput = false;		//run.evt holds evenly sampled records
+	}
+	if (!roi.empty()) preamble = roi.preamble();		//time axis and trigger offset of the first range
+	recordLength = static_cast<int>(roi.size() > 1 ? roi.points() : preamble.nPoints);
+	xinc = preamble.xinc;
+	xzero = preamble.xzero;
+	pt_off = static_cast<int>(preamble.pt_off);
+	ymult = preamble.ymult;
+	yzero = preamble.yzero;
+	yoff = preamble.yoff;
 
-	//set trigger source, level, edge
-	instrWrite(instr, "trigger:a:edge:source ch2", retCount);
-	instrWrite(instr, "trigger:a:level:ch2 0.04", retCount);
-	instrWrite(instr, "trigger:a:edge:slope rise", retCount);
+	//run setup: settings that stay the same for every event are sent once
+	batch.add("trigger:a:edge:source ch2");		//set trigger source, level, edge
+	batch.add("trigger:a:level:ch2 0.04");
+	batch.add("trigger:a:edge:slope rise");
+	batch.add("trigger:a:mode normal");			//set trigger mode
+	batch.add("trigger:a:holdoff:by time");		//set delay of 10 ms between events
+	batch.add("trigger:a:holdoff:time 0.01");	//to avoid recording same waveforms
+	preambleCache.flush(instr, batch, retCount);
 
 	triggered = 0;			//number of registered events
-	std::string dump;
-	ViInt8 rdbuf[recordLength + 8];
 	
 	//fill vector of time values, it will be used for each dataset
 	std::vector<double> xvalues;
@@ -78,7 +136,7 @@ int main() {
 	for (size_t i_t0 = 0; i_t0 < recordLength; i_t0++){
 		xvalues.push_back(t0 + xinc * i_t0);
 	}
-	std::string filename;			//output file name
+	if (roi.size() > 1) xvalues = roi.times();	//ranges back to back, with a jump in time between them
 
 	std::string nSens;
 	std::cout << "Enter the number of sensor or its string indentifier: \n";
@@ -93,57 +151,277 @@ int main() {
 	std::cout << "Enter the number of events to be registered:\n";
 	std::cin >> nEvents;
 
-	//main data acquisition loop
-	while (triggered < nEvents) {
-		instrQuery(instr, "trigger:state?", retCount, buffer);	//check trigger state
-		dump.assign(buffer, retCount);
-		//set trigger mode
-		instrWrite(instr, "trigger:a:mode normal", retCount);
-		instrWrite(instr, "trigger:a:holdoff:by time", retCount);	//set delay of 10 ms between events
-		instrWrite(instr, "trigger:a:holdoff:time 0.01", retCount);	//to avoid recording same waveforms
-
-		instrQuery(instr, "trigger:state?", retCount, buffer);	//on "trigger" state process waveform
-		dump.assign(buffer, retCount);
-		if (dump == "TRIGGER\n") {
-			
-			instrWrite(instr, "data:encdg ribinary", retCount);	//set ribinary data encoding
-			instrWrite(instr, "curve?", retCount);
-			//read from buffer data, number of data pieces are number of points (record length) +
-			//8 bytes of ieee header
-			viRead(instr, reinterpret_cast<ViUInt8*>(&rdbuf[0]), recordLength + 8, &retCount);
-			instrWrite(instr, "*WAI", retCount);
-
-			//create file with spectrum
-			std::ofstream of;
-			filename = "data_" + std::to_string(triggered + 1) + ".csv";
-			of.open(filename, std::ofstream::out | std::ofstream::trunc);
-
-			//check ieee format to skip first 8 bytes of data
-			//ieee format: #<number of digits representing number of points><number of pts><data>
-			//i.e.: #<5><62500><-27 -28 0 3 4 ...>
-			//values in rdbuf are signed int8_t from -127 to 127
-			
-			size_t divider = 1; //write each divider-th count from waveform to reduce size of data file
-			while (recordLength/divider > 20000) {
-				divider++;
+	//the whole acquisition is compiled once per sample type, the width costs nothing per sample
+	auto acquireEvents = [&](auto sampleType) {
+		using Sample = decltype(sampleType);
+		//output files first: a failed open changes the output path and with it the buffers needed
+		EventFileWriter runFile;
+		if (storeWaveforms && binaryOutput && !runFile.open("run.evt", sizeof(Sample), recordLength, xinc, xzero, pt_off, ymult, yzero, yoff)) {
+			binaryOutput = false;	//fall back to csv files
+		}
+		PulseFileWriter pulseFile;
+		if (extractFeatures && !pulseFile.open("pulses.dat")) extractFeatures = false;
+		//preallocate all waveform buffers once, readout and decode recycle them instead of allocating per event
+		nFrames = std::min(nFrames, nEvents);
+		size_t rawCapacity = recordLength * nFrames;
+		size_t voltsCapacity = binaryOutput || !storeWaveforms ? 0 : recordLength * nFrames;
+		size_t nBuffers = poolBudget / (rawCapacity * sizeof(Sample) + voltsCapacity * sizeof(double));
+		nBuffers = std::max<size_t>(2, std::min(nBuffers, queueDepth));
+		BufferPool<Sample> rawPool(nBuffers, rawCapacity, hugePages);
+		BufferPool<double> voltsPool(voltsCapacity > 0 ? nBuffers : 0, voltsCapacity, hugePages);
+		BufferPool<PulseFeatures> featuresPool(extractFeatures ? nBuffers : 0, nFrames, false);
+		BufferPool<int64_t> scopeTimesPool(recordTiming && nFrames > 1 ? nBuffers : 0, nFrames, false);
+
+		//decode thread: convert samples to volts, samples are signed int8_t from -127 to 127
+		//or int16_t from -32767 to 32767, one vectorized pass over all frames with the best kernel for this CPU
+		ConvertScale scale{ ymult, yzero, yoff };
+		//pulse features straight from the raw samples, baseline from the pre-trigger region
+		PulseConfig pulseConfig;
+		pulseConfig.baselineEnd = static_cast<size_t>(std::max(pt_off, 0) * 0.9);
+		if (roi.size() > 1) pulseConfig.windowEnd = roi.range(0).size();	//pulses are searched in the first range
+		PulseAnalyzer analyzePulse(pulseConfig, scale, xinc, xzero, pt_off);
+		//spectra: the decode thread fills its own histograms and merges them after each transfer,
+		//the storage thread checkpoints the merged ones
+		bool spectra = extractFeatures && buildSpectra;
+		SharedHistogram amplitudeSpectrum(amplitudeAxis), chargeSpectrum(chargeAxis);
+		Histogram amplitudeLocal(amplitudeAxis), chargeLocal(chargeAxis);
+		auto saveSpectra = [&]() {
+			amplitudeSpectrum.save("spectrum_amplitude.csv");
+			chargeSpectrum.save("spectrum_charge.csv");
+		};
+		auto lastCheckpoint = std::chrono::steady_clock::now();
+		//trigger timing: accounted by the readout thread, one line per event written by the storage thread
+		RunTiming runTiming;
+		CsvWriter timingCsv(1 << 16, 12);
+		if (recordTiming && timingCsv.open("timing.csv")) timingCsv.text("event,scope_s,armed_s,triggered_s,readout_s\n");
+		auto decodeTransfer = [&](RawTransfer<Sample>& raw, DecodedTransfer<Sample>& decoded) {
+			if (extractFeatures) {
+				decoded.features = featuresPool.acquire();
+				decoded.features->size = raw.nFrames;
+				for (size_t k = 0; k < raw.nFrames; k++) {
+					decoded.features->data[k] = analyzePulse(raw.frame(k), raw.recordLength, raw.firstEvent + k);
+				}
+				for (size_t k = 0; spectra && k < raw.nFrames; k++) {
+					const PulseFeatures& f = decoded.features->data[k];
+					if (f.flags & pulseNotFound) continue;
+					amplitudeLocal.fill(f.amplitude);
+					chargeLocal.fill(f.charge * pulseConfig.polarity);
+				}
+				if (spectra) {
+					amplitudeSpectrum.merge(amplitudeLocal);
+					chargeSpectrum.merge(chargeLocal);
+				}
+			}
+			if (storeWaveforms && !binaryOutput) {
+				decoded.volts = voltsPool.acquire();
+				decoded.volts->size = raw.nFrames * raw.recordLength;
+				convertSamples(raw.frame(0), raw.nFrames * raw.recordLength, decoded.volts->data, scale);	//frames are contiguous
+			}
+			decoded.raw = std::move(raw);
+		};
+		//storage thread: write each event in its own csv file or append it to the run file,
+		//then return the buffers to their pools
+		CsvWriter csv(1 << 20, csvPrecision);
+		Decimator decimate(decimateMode, targetPoints);		//picks the stored points from the raw samples
+		auto storeTransfer = [&](DecodedTransfer<Sample>& decoded) {
+			const RawTransfer<Sample>& raw = decoded.raw;
+			for (size_t k = 0; decoded.features != nullptr && k < decoded.features->size; k++) {
+				pulseFile.append(decoded.features->data[k]);
+			}
+			for (size_t k = 0; storeWaveforms && k < raw.nFrames; k++) {
+				if (binaryOutput) {
+					runFile.append(raw.frame(k), raw.recordLength);
+					continue;
+				}
+				const double* volts = decoded.volts->data + k * raw.recordLength;
+				std::string filename = "data_" + std::to_string(raw.firstEvent + k) + ".csv";
+				if (!csv.open(filename)) continue;
+				LatencyTimer format(LatencyStage::Csv);
+				const std::vector<uint32_t>& keep = decimate(raw.frame(k), raw.recordLength);
+				csv.rows(xvalues.data(), volts, keep.data(), keep.size());
+				format.stop();
+				LatencyTimer fileClose(LatencyStage::Close);
+				csv.close();
+			}
+			for (size_t k = 0; recordTiming && k < raw.nFrames; k++) {
+				const TransferTiming& t = raw.timing;
+				double scope = raw.scopeTimes != nullptr ? runTiming.scopeSeconds(raw.scopeTimes->data[k]) : std::nan("");
+				double values[] = { static_cast<double>(raw.firstEvent + k), scope,
+					runTiming.hostSeconds(t.armed), runTiming.hostSeconds(t.triggered), runTiming.hostSeconds(t.readout) };
+				timingCsv.row(values, 5);
+			}
+			if (spectra && std::chrono::steady_clock::now() - lastCheckpoint > std::chrono::duration<double>(checkpointInterval)) {
+				saveSpectra();
+				lastCheckpoint = std::chrono::steady_clock::now();
+			}
+			rawPool.release(decoded.raw.buffer);
+			voltsPool.release(decoded.volts);
+			featuresPool.release(decoded.features);
+			scopeTimesPool.release(decoded.raw.scopeTimes);
+			decoded.raw.buffer = nullptr;
+			decoded.raw.scopeTimes = nullptr;
+			decoded.volts = nullptr;
+			decoded.features = nullptr;
+		};
+		AcquisitionPipeline<RawTransfer<Sample>, DecodedTransfer<Sample>> pipeline(queueDepth);
+		latencyStats().start();		//the report covers the acquisition only, not the setup
+		runTiming.start();
+		uint64_t acquisitionsBefore = 0, acquisitionsAfter = 0;
+		//only free-running: FastFrame and SRQ restart the acquisition, which resets the scope's count
+		bool countAcquisitions = recordTiming && nFrames == 1 && !useSrq && QueryAcquisitionCount(instr, acquisitionsBefore, retCount, buffer) == 0;
+		pipeline.start(decodeTransfer, storeTransfer);
+
+		//readout thread: hand each transfer to the pipeline, only waits if the decode queue is full
+		auto pushTransfer = [&](RawTransfer<Sample>& raw) {
+			raw.nFrames = std::min(raw.nFrames, nEvents - triggered);
+			raw.firstEvent = triggered + 1;
+			triggered += raw.nFrames;
+			runTiming.record(raw.timing, raw.nFrames, raw.scopeTimes != nullptr ? raw.scopeTimes->data : nullptr);
+			latencyStats().addEvents(raw.nFrames);
+			latencyStats().addBytes(raw.buffer->size * sizeof(Sample));
+			pipeline.push(std::move(raw));
+			if ( triggered == 1 || triggered % 20 == 0 || triggered == nEvents) {	
+				std::cout << "Processed " << triggered << "/" << nEvents << " events, queued "
+					<< pipeline.decodeDepth() << " to decode, " << pipeline.storeDepth() << " to store" << '\r';//control progress
+			}
+		};
+		//read one waveform and hand it to the pipeline, the block header is parsed and only the samples are stored
+		//ieee format: #<number of digits representing number of points><number of pts><data><\n>
+		//i.e.: #<5><62500><-27 -28 0 3 4 ...>
+		//timing holds the arm and trigger stamps, the readout stamp is added here
+		auto readCurve = [&](const TransferTiming& timing) {
+			RawTransfer<Sample> raw;
+			size_t nBytes;
+			raw.timing = timing;
+			raw.buffer = rawPool.acquire();
+			LatencyTimer transfer(LatencyStage::Curve);
+			bool ok;
+			if (roi.size() > 1) ok = ReadRoiCurves(instr, roi, raw.buffer->data, raw.buffer->capacity * sizeof(Sample), sizeof(Sample), nBytes, retCount) == 0;
+			else {
+				instrWrite(instr, scpi::curve, retCount);
+				ok = ReadIeeeBlock(instr, raw.buffer->data, raw.buffer->capacity * sizeof(Sample), nBytes, retCount) == 0;
+			}
+			if (!ok || nBytes < sizeof(Sample)) {
+				rawPool.putBack(raw.buffer);		//waveform is dropped, the next trigger is read as usual
+				return;
 			}
-			//skip first 8 bytes of data, write waveform in csv file
-			for (size_t i = 7; i < (sizeof(rdbuf) - 1); i++) {
-					if (i % divider == 0) {
-						of << std::setprecision(5) << xvalues[i-7] << ","
-							<< static_cast<double>((rdbuf[i] - yoff )*ymult + yzero) << '\n';
+			transfer.stop();
+			raw.timing.readout = TransferTiming::Clock::now();
+			raw.buffer->size = nBytes / sizeof(Sample);
+			raw.recordLength = std::min<size_t>(raw.buffer->size, recordLength);
+			raw.nFrames = 1;
+			pushTransfer(raw);
+		};
+
+		if (nFrames > 1) {
+			//FastFrame acquisition: capture nFrames events in segmented memory, read them in one transfer
+			SetupFastFrame(instr, nFrames, retCount);
+			transportSetTimeout(instr, static_cast<ViUInt32>(10000 + 20 * nFrames));	//*opc? returns after nFrames triggers
+			while (triggered < nEvents) {
+				RawTransfer<Sample> block;
+				block.buffer = rawPool.acquire();
+				if (AcquireFastFrame(instr, recordLength, nFrames, block, retCount, buffer) != 0) {
+					rawPool.putBack(block.buffer);
+					break;
+				}
+				if (recordTiming) {
+					//one more query per sequence for the trigger time of every frame
+					block.scopeTimes = scopeTimesPool.acquire();
+					if (ReadFrameTimestamps(instr, nFrames, block.scopeTimes->data, retCount) != 0) {
+						scopeTimesPool.putBack(block.scopeTimes);
+						block.scopeTimes = nullptr;
+					}
+				}
+				pushTransfer(block);	//frames are split into per-event waveforms downstream
+			}
+			DisableFastFrame(instr, retCount);
+		}
+		else if (useSrq) {
+			//event-driven acquisition: one single sequence per event, completion signalled by SRQ
+			instrWrite(instr, "acquire:stopafter sequence", retCount);
+			if (EnableSrqOnOpc(instr, retCount) == 0) {
+				while (triggered < nEvents) {
+					TransferTiming timing;
+					LatencyTimer triggerWait(LatencyStage::TriggerWait);
+					timing.armed = TransferTiming::Clock::now();
+					int waited = WaitForAcquisition(instr, 10000, retCount);
+					if (waited == 5 && roi.size() > 1) continue;	//no trigger yet: ranges need a stopped acquisition, re-arm instead of polling a free-running scope
+					if (waited != 0) break;		//fall back to polling below, or end the run with several ranges
+					timing.triggered = TransferTiming::Clock::now();
+					triggerWait.stop();
+					readCurve(timing);
+				}
+				DisableSrq(instr, retCount);
+			}
+			batch.add("acquire:stopafter runstop").add("acquire:state run").flush(instr, retCount);
+		}
+		else if (useCurveStream) {
+			//streaming acquisition: blocks arrive back to back on one long-lived response,
+			//the time between two of them counts as live since the scope re-arms by itself
+			if (StartCurveStream(instr, retCount) == 0) {
+				auto armed = TransferTiming::Clock::now();
+				while (triggered < nEvents) {
+					RawTransfer<Sample> raw;
+					raw.timing.armed = armed;
+					raw.buffer = rawPool.acquire();
+					if (ReadStreamedCurve(instr, raw, retCount) != 0) {
+						rawPool.putBack(raw.buffer);
+						break;		//stream out of step, stop it and poll for the remaining events
 					}
+					raw.recordLength = std::min<size_t>(raw.recordLength, recordLength);
+					armed = raw.timing.readout;
+					pushTransfer(raw);
+				}
+				StopCurveStream(instr);
 			}
+		}
 
-			triggered++;	//increment number of registered events
-			of.close();
+		//main data acquisition loop, the trigger wait is the time spent polling until the scope reports a trigger,
+		//the scope counts as armed from the end of the previous readout; never with several ranges,
+		//a free-running scope would give each of them from another acquisition
+		bool poll = roi.size() <= 1;
+		if (!poll && triggered < nEvents) std::cout << "Service requests unavailable, several regions of interest can't be read\n";
+		TransferTiming timing;
+		timing.armed = TransferTiming::Clock::now();
+		while (poll && triggered < nEvents) {
+			instrQuery(instr, scpi::triggerState, retCount, buffer);	//on "trigger" state process waveform
+			if (std::string_view(buffer, retCount) == scpi::triggered) {
+				timing.triggered = TransferTiming::Clock::now();
+				latencyStats().record(LatencyStage::TriggerWait, timing.triggered - timing.armed);
+				readCurve(timing);
+				timing.armed = TransferTiming::Clock::now();
+			}
 		}
-		if ( triggered == 1 || triggered % 20 == 0 || triggered == nEvents) {	
-			std::cout << "Processed " << triggered << "/" << nEvents << " events" << '\r';//control progress
+		if (countAcquisitions && QueryAcquisitionCount(instr, acquisitionsAfter, retCount, buffer) == 0 && acquisitionsAfter >= acquisitionsBefore) {
+			runTiming.setScopeAcquisitions(acquisitionsAfter - acquisitionsBefore);
 		}
-	}
-	
-	std::cout << '\n';
+
+		if (roi.size() > 1) preambleCache.invalidate();	//the scope is left on the last range
+		pipeline.finish();		//wait until all events are written
+		runFile.close();
+		pulseFile.close();
+		timingCsv.close();
+		std::cout << '\n';
+		if (spectra) {
+			saveSpectra();
+			SpectrumPeak peak;
+			if (FitSpectrumPeak(amplitudeSpectrum.snapshot(), amplitudeAxis, peak) == 0) {
+				std::cout << "amplitude peak: " << peak.mean << " V, sigma " << peak.sigma << " V (" << peak.entries << " events)\n";
+			}
+			if (FitSpectrumPeak(chargeSpectrum.snapshot(), chargeAxis, peak) == 0) {
+				std::cout << "charge peak: " << peak.mean << " C, sigma " << peak.sigma << " C (" << peak.entries << " events)\n";
+			}
+		}
+		pipeline.printStats();
+		std::cout << "buffer pool: " << nBuffers << " x " << rawCapacity * sizeof(Sample) << " bytes"
+			<< (rawPool.hugePages() ? " on huge pages" : "") << ", " << rawPool.waits() << " readout waits\n";
+		latencyStats().print(std::cout);
+		latencyStats().writeJson("latency.json");
+		if (recordTiming) runTiming.print(std::cout);
+	};
+	if (sampleWidth == 2) acquireEvents(int16_t());
+	else acquireEvents(ViInt8());
+
 	instrWrite(instr, "trigger:a:holdoff:by random", retCount);	//cancel delay between acquisitions
 																//for fast acq screenshot
 	instrWrite(instr, "trigger:a:level:ch2 0.01", retCount);
@@ -153,13 +431,13 @@ int main() {
 	instrWrite(instr, "save:image \"C:/st.png\"\n", retCount); //save image into osc memory
 	instrWrite(instr, "*wai", retCount);						//wait for data to be written
 
-	viSetAttribute(instr, VI_ATTR_TMO_VALUE, 25000);			//set larger timeout 25 s
+	transportSetTimeout(instr, 25000);						//set larger timeout 25 s
 	instrWrite(instr, "filesystem:readfile \"C:/st.png\"", retCount);	//read image in binary format from osc memory
 	std::string fname = "!st.png";		//create file on local storage in which data is written
 	std::ofstream of_pic;
 	ViChar* picbuf[16000];				//buffer for picture file
 	of_pic.open(fname, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);//open file in binary output mode
-	viRead(instr, reinterpret_cast<unsigned char*>(&picbuf[0]), sizeof(picbuf),&retCount);//read data from osc buffer
+	transportRead(instr, reinterpret_cast<unsigned char*>(&picbuf[0]), sizeof(picbuf),&retCount);//read data from osc buffer
 	instrWrite(instr, "*wai", retCount);													//wait for data to be written in buffer
 
 	of_pic.write(reinterpret_cast<char*> (picbuf), sizeof(picbuf));	//write data in output file
@@ -171,7 +449,7 @@ int main() {
 
 	std::filesystem::current_path("../");
 
-	viClose(instr);
+	closeTransport(instr);
 	viClose(defaultRM);
 	std::cout << "Done! Press 1 and hit ENTER to finish.\n";
 	int a;
@@ -0,0 +1,257 @@
+//-------------------------------------------------------------------------------
+// Loopback stand-in for the network interfaces of the MSO44: serves one simulated
+// instrument over a raw SCPI socket (port 4000) and HiSLIP (port 4880), so the native
+// transports of tcp_transport.h can be benchmarked side by side with the VISA
+// simulator. All connections share the instrument, as they would on the scope.
+//
+// usage: mso44_server [--socket-port N] [--hislip-port N] [--bind ADDR], port 0 disables
+//-------------------------------------------------------------------------------
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "tcp_transport.h"
+#include "mso44_sim.h"
+
+namespace {
+
+struct Instrument {
+	std::mutex mutex;				// held while the simulator runs a command and while sending
+	std::condition_variable changed;	// a program message was executed
+	Mso44Sim sim;
+	size_t srqDelivered = 0;		// operations complete already reported with AsyncServiceRequest
+};
+
+TcpSocket listenOn(const std::string& address, uint16_t port) {
+	if (!TcpSocket::startup()) return TcpSocket();
+	addrinfo hints{}, *addresses = nullptr;
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if (getaddrinfo(address.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0) return TcpSocket();
+	TcpSocket listener;
+	for (addrinfo* a = addresses; a != nullptr && !listener.valid(); a = a->ai_next) {
+		TcpSocket candidate(::socket(a->ai_family, a->ai_socktype, a->ai_protocol));
+		if (!candidate.valid()) continue;
+		int on = 1;
+		setsockopt(candidate.handle(), SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&on), sizeof(on));
+		if (::bind(candidate.handle(), a->ai_addr, static_cast<int>(a->ai_addrlen)) == 0 && ::listen(candidate.handle(), 8) == 0) {
+			listener = std::move(candidate);
+		}
+	}
+	freeaddrinfo(addresses);
+	return listener;
+}
+
+TcpSocket acceptOn(TcpSocket& listener) {
+	TcpSocket client(::accept(listener.handle(), nullptr, nullptr));
+	if (client.valid()) client.tune();
+	return client;
+}
+
+// sends every queued response, called with the instrument locked
+template<typename SendFn>
+bool sendOutput(Instrument& instrument, SendFn send) {
+	while (instrument.sim.hasOutput()) {
+		if (!send(instrument.sim.frontOutput())) return false;
+		instrument.sim.popOutput();
+	}
+	return true;
+}
+
+// raw socket: program messages end with '\n', responses are sent as they are
+void serveSocket(TcpSocket client, Instrument& instrument) {
+	std::vector<char> rx(64 * 1024);
+	std::string pending;
+	while (true) {
+		long got = client.recvSome(rx.data(), rx.size(), -1);
+		if (got <= 0) return;
+		pending.append(rx.data(), static_cast<size_t>(got));
+		size_t end;
+		while ((end = pending.find('\n')) != std::string::npos) {
+			std::string_view message(pending.data(), end);
+			if (!message.empty() && message.back() == '\r') message.remove_suffix(1);
+			std::lock_guard<std::mutex> lock(instrument.mutex);
+			instrument.sim.write(message);
+			if (!sendOutput(instrument, [&](const std::string& out) { return client.sendAll(out.data(), out.size()); })) return;
+			pending.erase(0, end + 1);
+		}
+	}
+}
+
+bool skipPayload(TcpSocket& socket, uint64_t n) {
+	char sink[4096];
+	while (n > 0) {
+		size_t take = static_cast<size_t>(std::min<uint64_t>(n, sizeof(sink)));
+		if (!socket.recvAll(sink, take, -1)) return false;
+		n -= take;
+	}
+	return true;
+}
+
+// HiSLIP synchronous channel: Data/DataEnd messages are collected into one program
+// message, each response goes back as a DataEnd with the MessageID of the command
+void serveHislipSync(TcpSocket client, Instrument& instrument) {
+	std::vector<uint8_t> scratch;
+	std::string message;
+	hislip::Header h;
+	while (hislip::receiveHeader(client, h, -1)) {
+		if (h.type == hislip::Data || h.type == hislip::DataEnd) {
+			size_t offset = message.size();
+			message.resize(offset + h.length);
+			if (h.length > 0 && !client.recvAll(&message[offset], h.length, -1)) return;
+			if (h.type == hislip::Data) continue;
+			uint32_t messageId = h.parameter;
+			auto send = [&](const std::string& out) {
+				return hislip::sendMessage(client, hislip::DataEnd, 0, messageId, out.data(), out.size(), scratch);
+			};
+			{
+				std::lock_guard<std::mutex> lock(instrument.mutex);
+				instrument.sim.write(message);
+				message.clear();
+				instrument.changed.notify_all();
+				if (!sendOutput(instrument, send)) return;
+			}
+			// CURVEStream?: one DataEnd per acquisition until the device clear of the
+			// asynchronous channel ends the stream or the client sends something; blocks are
+			// sent unlocked, a client that stops reading must not hold up the device clear
+			std::string block;
+			while (!client.waitReadable(0)) {
+				{
+					std::lock_guard<std::mutex> lock(instrument.mutex);
+					if (!instrument.sim.streaming()) break;
+					instrument.sim.streamCurve();
+					block.swap(instrument.sim.frontOutput());
+					instrument.sim.popOutput();
+				}
+				if (!send(block)) return;
+			}
+		}
+		else if (h.type == hislip::DeviceClearComplete) {
+			message.clear();
+			if (!hislip::sendMessage(client, hislip::DeviceClearAcknowledge, h.control, 0, nullptr, 0, scratch)) return;
+		}
+		else if (!skipPayload(client, h.length)) return;
+	}
+}
+
+// HiSLIP asynchronous channel: status queries and device clear are answered as they
+// arrive, a second thread raises a service request once per operation complete while
+// *SRE enables them, woken by the synchronous channel or when the pending one is due
+void serveHislipAsync(TcpSocket client, Instrument& instrument) {
+	using Clock = Mso44Sim::Clock;
+	std::vector<uint8_t> scratch, srqScratch;
+	std::atomic<bool> open{ true };
+	std::thread notifier([&]() {
+		std::unique_lock<std::mutex> lock(instrument.mutex);
+		Mso44Sim& sim = instrument.sim;
+		while (open) {
+			Clock::time_point when;
+			if (sim.requestingService() && sim.operationsCompleted() != instrument.srqDelivered) {
+				instrument.srqDelivered = sim.operationsCompleted();
+				if (!hislip::sendMessage(client, hislip::AsyncServiceRequest, sim.statusByte(), 0, nullptr, 0, srqScratch)) break;
+			}
+			else if (sim.pendingServiceRequest(when)) instrument.changed.wait_until(lock, when);
+			else instrument.changed.wait_for(lock, std::chrono::milliseconds(100));
+		}
+	});
+
+	hislip::Header h;
+	while (hislip::receiveHeader(client, h, -1) && skipPayload(client, h.length)) {
+		std::lock_guard<std::mutex> lock(instrument.mutex);
+		bool sent = true;
+		if (h.type == hislip::AsyncStatusQuery) {
+			sent = hislip::sendMessage(client, hislip::AsyncStatusResponse, instrument.sim.statusByte(), 0, nullptr, 0, scratch);
+		}
+		else if (h.type == hislip::AsyncDeviceClear) {
+			instrument.sim.clear();
+			sent = hislip::sendMessage(client, hislip::AsyncDeviceClearAcknowledge, 0, 0, nullptr, 0, scratch);
+		}
+		else if (h.type == hislip::AsyncMaximumMessageSize) {
+			uint8_t size[8];
+			for (int i = 0; i < 8; i++) size[i] = 0xff;
+			sent = hislip::sendMessage(client, hislip::AsyncMaximumMessageSizeResponse, 0, 0, size, sizeof(size), scratch);
+		}
+		if (!sent) break;
+	}
+	open = false;
+	instrument.changed.notify_all();
+	notifier.join();
+}
+
+// the first message tells the synchronous (Initialize) from the asynchronous channel
+void serveHislip(TcpSocket client, Instrument& instrument) {
+	static std::atomic<uint16_t> nextSessionId{ 1 };
+	std::vector<uint8_t> scratch;
+	hislip::Header h;
+	if (!hislip::receiveHeader(client, h, 5000) || !skipPayload(client, h.length)) return;
+	if (h.type == hislip::Initialize) {
+		uint32_t parameter = (uint32_t(hislip::protocolVersion) << 16) | nextSessionId++;
+		if (hislip::sendMessage(client, hislip::InitializeResponse, 0, parameter, nullptr, 0, scratch)) serveHislipSync(std::move(client), instrument);
+	}
+	else if (h.type == hislip::AsyncInitialize) {
+		uint32_t vendor = ('S' << 8) | 'M';
+		if (hislip::sendMessage(client, hislip::AsyncInitializeResponse, 0, vendor, nullptr, 0, scratch)) serveHislipAsync(std::move(client), instrument);
+	}
+}
+
+template<typename ServeFn>
+std::thread acceptLoop(TcpSocket listener, Instrument& instrument, ServeFn serve) {
+	return std::thread([listener = std::move(listener), &instrument, serve]() mutable {
+		while (true) {
+			TcpSocket client = acceptOn(listener);
+			if (!client.valid()) continue;
+			std::thread(serve, std::move(client), std::ref(instrument)).detach();
+		}
+	});
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	uint16_t socketPort = SocketTransport::defaultPort;
+	uint16_t hislipPort = hislip::defaultPort;
+	std::string address = "127.0.0.1";
+	for (int i = 1; i < argc; i++) {
+		if (!std::strcmp(argv[i], "--socket-port") && i + 1 < argc) socketPort = static_cast<uint16_t>(std::atoi(argv[++i]));
+		else if (!std::strcmp(argv[i], "--hislip-port") && i + 1 < argc) hislipPort = static_cast<uint16_t>(std::atoi(argv[++i]));
+		else if (!std::strcmp(argv[i], "--bind") && i + 1 < argc) address = argv[++i];
+		else {
+			std::printf("usage: mso44_server [--socket-port N] [--hislip-port N] [--bind ADDR]\n");
+			return 1;
+		}
+	}
+
+	Instrument instrument;
+	std::vector<std::thread> listeners;
+	if (socketPort != 0) {
+		TcpSocket listener = listenOn(address, socketPort);
+		if (!listener.valid()) {
+			std::printf("Cannot listen on %s:%u\n", address.c_str(), socketPort);
+			return 1;
+		}
+		listeners.push_back(acceptLoop(std::move(listener), instrument, serveSocket));
+		std::printf("mso44_server: raw socket on %s:%u\n", address.c_str(), socketPort);
+	}
+	if (hislipPort != 0) {
+		TcpSocket listener = listenOn(address, hislipPort);
+		if (!listener.valid()) {
+			std::printf("Cannot listen on %s:%u\n", address.c_str(), hislipPort);
+			return 1;
+		}
+		listeners.push_back(acceptLoop(std::move(listener), instrument, serveHislip));
+		std::printf("mso44_server: HiSLIP on %s:%u\n", address.c_str(), hislipPort);
+	}
+	std::fflush(stdout);
+	for (std::thread& t : listeners) t.join();
+	return 0;
+}
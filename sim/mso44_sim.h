@@ -0,0 +1,538 @@
+#pragma once
+
+// Software stand-in for the Tektronix MSO44: understands the SCPI subset used by
+// pcontrol and produces synthetic detector pulses at a configurable trigger rate.
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+#include <thread>
+
+struct Mso44SimConfig {
+	double triggerRate = 1000.0;		// mean trigger rate, Hz
+	bool poissonTriggers = true;		// exponential inter-trigger intervals if true, periodic otherwise
+	size_t recordLength = 62500;		// default record length, points
+	double sampleInterval = 3.2e-10;	// seconds per point
+	double triggerPosition = 0.2;		// fraction of record before trigger point
+	double pulseAmplitude = 0.2;		// mean pulse amplitude, V
+	double riseTime = 2e-9;				// pulse rise constant, s
+	double decayTime = 20e-9;			// pulse decay constant, s
+	double noise = 0.004;				// rms noise, V
+	double verticalRange = 1.0;			// full scale, V
+	size_t imageSize = 16000;			// size of the fake screenshot, bytes
+	unsigned seed = 12345;
+
+	// Overrides defaults from MSO44_SIM_* environment variables
+	static Mso44SimConfig fromEnvironment() {
+		Mso44SimConfig cfg;
+		if (const char* v = std::getenv("MSO44_SIM_TRIGGER_RATE")) cfg.triggerRate = std::atof(v);
+		if (const char* v = std::getenv("MSO44_SIM_PERIODIC")) cfg.poissonTriggers = std::atoi(v) == 0;
+		if (const char* v = std::getenv("MSO44_SIM_RECORD_LENGTH")) cfg.recordLength = std::strtoull(v, nullptr, 10);
+		if (const char* v = std::getenv("MSO44_SIM_AMPLITUDE")) cfg.pulseAmplitude = std::atof(v);
+		if (const char* v = std::getenv("MSO44_SIM_NOISE")) cfg.noise = std::atof(v);
+		if (const char* v = std::getenv("MSO44_SIM_SEED")) cfg.seed = static_cast<unsigned>(std::atoi(v));
+		return cfg;
+	}
+};
+
+// Matches a SCPI program header against a pattern written in the manual's
+// notation (upper case part is the short form), e.g. "WFMOutpre:NR_Pt?".
+// A pattern node "*" matches any single node.
+inline bool scpiMatch(std::string_view header, std::string_view pattern) {
+	if (!header.empty() && header.front() == ':') header.remove_prefix(1);
+	while (true) {
+		size_t hEnd = header.find(':');
+		size_t pEnd = pattern.find(':');
+		std::string_view hNode = header.substr(0, hEnd);
+		std::string_view pNode = pattern.substr(0, pEnd);
+		if (pNode != "*") {
+			size_t shortLen = 0;
+			while (shortLen < pNode.size() && !std::islower(static_cast<unsigned char>(pNode[shortLen]))) shortLen++;
+			if (hNode.size() < shortLen || hNode.size() > pNode.size()) return false;
+			for (size_t i = 0; i < hNode.size(); i++) {
+				if (std::toupper(static_cast<unsigned char>(hNode[i])) != std::toupper(static_cast<unsigned char>(pNode[i]))) return false;
+			}
+		}
+		if ((hEnd == std::string_view::npos) != (pEnd == std::string_view::npos)) return false;
+		if (hEnd == std::string_view::npos) return true;
+		header.remove_prefix(hEnd + 1);
+		pattern.remove_prefix(pEnd + 1);
+	}
+}
+
+class Mso44Sim {
+public:
+	using Clock = std::chrono::steady_clock;
+
+	explicit Mso44Sim(const Mso44SimConfig& cfg = Mso44SimConfig::fromEnvironment())
+		: cfg_(cfg), rng_(cfg.seed), acquisitionRng_(cfg.seed + 1), recordLength_(cfg.recordLength), stop_(cfg.recordLength) {
+		std::normal_distribution<double> gauss(0.0, 1.0);
+		noiseTable_.resize(1 << 16);
+		for (auto& n : noiseTable_) n = static_cast<float>(gauss(rng_));
+		clockBase_ = Clock::now();
+		wallBase_ = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		scheduleTrigger(clockBase_);
+	}
+
+	// Feeds one program message (possibly several ';'-separated commands)
+	void write(std::string_view message) {
+		path_.clear();
+		while (!message.empty()) {
+			size_t end = message.find(';');
+			std::string_view cmd = trim(message.substr(0, end));
+			if (!cmd.empty()) {
+				// a command without leading ':' or '*' continues the previous command's subsystem
+				if (cmd.front() == ':') cmd.remove_prefix(1);
+				else if (cmd.front() != '*' && !path_.empty()) {
+					command_.assign(path_);
+					command_.append(cmd);
+					cmd = command_;
+				}
+				execute(cmd);
+				if (cmd.front() != '*') {
+					std::string_view header = cmd.substr(0, cmd.find(' '));
+					size_t lastColon = header.rfind(':');
+					path_.assign(lastColon == std::string_view::npos ? std::string_view() : header.substr(0, lastColon + 1));
+				}
+			}
+			if (end == std::string_view::npos) break;
+			message.remove_prefix(end + 1);
+		}
+	}
+
+	// Next pending response message, empty if nothing is queued
+	bool hasOutput() const { return !output_.empty(); }
+	std::string& frontOutput() { return output_.front(); }
+	void popOutput() {
+		spare_.push_back(std::move(output_.front()));
+		spare_.back().clear();
+		output_.pop_front();
+	}
+
+	// Device clear: drops all pending responses and ends a curve stream
+	void clear() {
+		while (hasOutput()) popOutput();
+		path_.clear();
+		streaming_ = false;
+	}
+
+	// CURVEStream?: every acquisition is sent as a curve? block of its own until a device
+	// clear, the transport asks for the next one once the previous one is out
+	bool streaming() const { return streaming_; }
+	void streamCurve() { curve(); }
+
+	// IEEE 488.2 status byte: ESB (bit 5) summarizes *ESR & *ESE, MSS (bit 6) requests service
+	uint8_t statusByte() {
+		updateStatus();
+		uint8_t stb = 0;
+		if (!output_.empty()) stb |= 0x10;
+		if (esr_ & ese_) stb |= 0x20;
+		if (stb & sre_) stb |= 0x40;
+		return stb;
+	}
+
+	bool requestingService() { return (statusByte() & 0x40) != 0; }
+
+	// Incremented every time an operation complete is flagged in the ESR
+	size_t operationsCompleted() {
+		updateStatus();
+		return opcCount_;
+	}
+
+	// True if an operation complete that will raise a service request is pending; when is set to its time
+	bool pendingServiceRequest(Clock::time_point& when) const {
+		if (!opcPending_ || !(ese_ & 0x01) || !(sre_ & 0x20)) return false;
+		when = opcAt_;
+		return true;
+	}
+
+	size_t errors() const { return errors_; }
+	const Mso44SimConfig& config() const { return cfg_; }
+
+private:
+	static std::string_view trim(std::string_view s) {
+		while (!s.empty() && std::isspace(static_cast<unsigned char>(s.front()))) s.remove_prefix(1);
+		while (!s.empty() && std::isspace(static_cast<unsigned char>(s.back()))) s.remove_suffix(1);
+		return s;
+	}
+
+	std::string& newOutput() {
+		if (spare_.empty()) output_.emplace_back();
+		else {
+			output_.push_back(std::move(spare_.back()));
+			spare_.pop_back();
+		}
+		return output_.back();
+	}
+
+	void reply(std::string_view headerText, const std::string& value) {
+		std::string& out = newOutput();
+		if (headers_) {
+			out.append(headerText);
+			out.push_back(' ');
+		}
+		out.append(value);
+		out.push_back('\n');
+	}
+
+	static std::string num(double v) {
+		char buf[32];
+		std::snprintf(buf, sizeof(buf), "%.4E", v);
+		return buf;
+	}
+
+	Clock::duration nextInterval(std::mt19937_64& rng) {
+		double interval = 1.0 / cfg_.triggerRate;
+		if (cfg_.poissonTriggers) interval = std::exponential_distribution<double>(cfg_.triggerRate)(rng);
+		return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(std::max(interval, holdoff_)));
+	}
+
+	Clock::duration nextInterval() { return nextInterval(rng_); }
+
+	void scheduleTrigger(Clock::time_point from) { nextTrigger_ = from + nextInterval(); }
+
+	bool triggered() const { return Clock::now() >= nextTrigger_; }
+
+	size_t framesPerSequence() const { return fastFrame_ ? frameCount_ : 1; }
+
+	// Single sequence: the acquisition completes once all frames have triggered
+	void armSequence() {
+		Clock::time_point t = std::max(Clock::now(), nextTrigger_);
+		frameTimes_.assign(1, t);
+		for (size_t i = 1; i < framesPerSequence(); i++) {
+			t += nextInterval();
+			frameTimes_.push_back(t);
+		}
+		acquisitions_ += framesPerSequence();
+		sequenceSeed_ = rng_();
+		sequenceDone_ = t;
+		sequenceArmed_ = true;
+		scheduleTrigger(t);
+	}
+
+	void waitForSequence() {
+		if (sequenceArmed_) std::this_thread::sleep_until(sequenceDone_);
+	}
+
+	void updateStatus() {
+		if (opcPending_ && Clock::now() >= opcAt_) {
+			esr_ |= 0x01;
+			opcPending_ = false;
+			opcCount_++;
+		}
+	}
+
+	bool sequenceRunning() const { return sequenceArmed_ && Clock::now() < sequenceDone_; }
+
+	// "02 Mar 2000 20:10:54.542 037 272 620" in UTC, the simulator clock mapped to wall time
+	std::string timestamp(Clock::time_point t) const {
+		int64_t ns = wallBase_ + std::chrono::duration_cast<std::chrono::nanoseconds>(t - clockBase_).count();
+		std::time_t seconds = static_cast<std::time_t>(ns / 1000000000);
+		long fraction = static_cast<long>(ns % 1000000000);
+		char text[64];
+		size_t n = std::strftime(text, sizeof(text), "%d %b %Y %H:%M:%S", std::gmtime(&seconds));
+		std::snprintf(text + n, sizeof(text) - n, ".%03ld %03ld %03ld 000", fraction / 1000000, fraction / 1000 % 1000, fraction % 1000);
+		return text;
+	}
+
+	// free-running, the scope keeps triggering while a captured waveform waits for curve?:
+	// those acquisitions overwrite each other, they are counted but never read
+	void countAcquisitions() {
+		Clock::time_point now = Clock::now();
+		if (stopAfterSequence_ || now < nextTrigger_) return;
+		if (countedUntil_ < nextTrigger_) {
+			acquisitions_++;				// the waveform curve? returns
+			countedUntil_ = nextTrigger_;
+		}
+		for (Clock::time_point t = countedUntil_ + nextInterval(acquisitionRng_); t < now; t += nextInterval(acquisitionRng_)) acquisitions_++;
+		countedUntil_ = now;
+	}
+
+	std::string frameTimestamps() const {
+		std::string reply;
+		for (size_t i = 0; i < frameTimes_.size(); i++) {
+			if (i > 0) reply += ',';
+			reply += '"' + timestamp(frameTimes_[i]) + '"';
+		}
+		return reply;
+	}
+
+	double ymult() const { return cfg_.verticalRange / (width_ == 1 ? 250.0 : 64000.0); }
+	double pointOffset() const { return std::floor(recordLength_ * cfg_.triggerPosition); }
+
+	// points selected by DATa:STARt/STOP, clipped to the record
+	size_t firstPoint() const { return std::min(start_, recordLength_); }
+	size_t transferPoints() const {
+		size_t last = std::min(stop_, recordLength_);
+		return last >= firstPoint() ? last - firstPoint() + 1 : 0;
+	}
+	// PT_Off counts from the first transferred point
+	long transferOffset() const { return static_cast<long>(pointOffset()) - static_cast<long>(firstPoint() - 1); }
+
+	// WFMOutpre? reply in the field order of the MSO4/5/6 manual:
+	// BYT_Nr;BIT_Nr;ENCdg;BN_Fmt;BYT_Or;WFId;NR_Pt;PT_Fmt;PT_ORder;XUNit;XINcr;XZEro;PT_Off;
+	// YUNit;YMUlt;YOFf;YZEro;DOMain;WFMTYPe;CENTERFREQuency;SPAN;REFLevel;FRAMESTARt
+	std::string preamble() const {
+		std::string p = std::to_string(width_) + ";" + std::to_string(8 * width_) + ";BINARY;RI;" + (littleEndian_ ? "LSB" : "MSB");
+		p += ";\"Ch2, DC coupling, " + num(cfg_.verticalRange / 10) + "V/div, " + std::to_string(recordLength_) + " points, Sample mode\"";
+		p += ";" + std::to_string(transferPoints()) + ";Y;LINEAR;\"s\";" + num(cfg_.sampleInterval) + ";" + num(0.0);
+		p += ";" + std::to_string(transferOffset()) + ";\"V\";" + num(ymult()) + ";" + num(0.0) + ";" + num(0.0);
+		p += ";TIME;ANALOG;" + num(0.0) + ";" + num(0.0) + ";" + num(0.0) + ";1";
+		return p;
+	}
+
+	void execute(std::string_view cmd) {
+		size_t space = cmd.find(' ');
+		std::string_view header = cmd.substr(0, space);
+		std::string_view arg = space == std::string_view::npos ? std::string_view() : trim(cmd.substr(space + 1));
+		bool query = !header.empty() && header.back() == '?';
+		if (query) header.remove_suffix(1);
+
+		if (scpiMatch(header, "*IDN")) reply("*IDN", "TEKTRONIX,MSO44,SIM000001,CF:91.1CT FV:1.0.0");
+		else if (scpiMatch(header, "*OPC") && query) {
+			waitForSequence();
+			reply("*OPC", "1");
+		}
+		else if (scpiMatch(header, "*OPC")) {
+			// operation complete is signalled when the running single sequence has finished
+			opcPending_ = true;
+			opcAt_ = sequenceArmed_ ? sequenceDone_ : Clock::now();
+		}
+		else if (scpiMatch(header, "*CLS")) {
+			esr_ = 0;
+			opcPending_ = false;
+		}
+		else if (scpiMatch(header, "*ESE")) {
+			if (query) reply("*ESE", std::to_string(ese_));
+			else ese_ = static_cast<uint8_t>(std::atoi(std::string(arg).c_str()));
+		}
+		else if (scpiMatch(header, "*SRE")) {
+			if (query) reply("*SRE", std::to_string(sre_));
+			else sre_ = static_cast<uint8_t>(std::atoi(std::string(arg).c_str()));
+		}
+		else if (scpiMatch(header, "*ESR") && query) {
+			updateStatus();
+			reply("*ESR", std::to_string(esr_));
+			esr_ = 0;
+		}
+		else if (scpiMatch(header, "*STB") && query) reply("*STB", std::to_string(statusByte()));
+		else if (scpiMatch(header, "*WAI") || scpiMatch(header, "*RST")) {}
+		else if (scpiMatch(header, "HEADer")) headers_ = arg == "1" || arg == "ON" || arg == "on";
+		else if (scpiMatch(header, "DATa:SOUrce")) {}
+		else if (scpiMatch(header, "DATa:ENCdg")) {
+			if (query) reply(":DATA:ENCDG", littleEndian_ ? "SRIBINARY" : "RIBINARY");
+			else littleEndian_ = arg.size() >= 3 && (arg[0] == 'S' || arg[0] == 's');	//SRIbinary, RIBinary
+		}
+		else if (scpiMatch(header, "DATa:WIDth")) {
+			if (query) reply(":DATA:WIDTH", std::to_string(width_));
+			else width_ = std::atoi(std::string(arg).c_str()) == 2 ? 2 : 1;
+		}
+		else if (scpiMatch(header, "DATa:STARt")) {
+			if (query) reply(":DATA:START", std::to_string(start_));
+			else start_ = static_cast<size_t>(std::max(1.0, std::atof(std::string(arg).c_str())));
+		}
+		else if (scpiMatch(header, "DATa:STOP")) {
+			if (query) reply(":DATA:STOP", std::to_string(stop_));
+			else stop_ = static_cast<size_t>(std::max(1.0, std::min(1e15, std::atof(std::string(arg).c_str()))));
+		}
+		else if (scpiMatch(header, "HORizontal:RECOrdlength")) {
+			if (query) reply(":HORIZONTAL:RECORDLENGTH", std::to_string(recordLength_));
+			else recordLength_ = std::max<size_t>(1000, std::strtoull(std::string(arg).c_str(), nullptr, 10));
+		}
+		else if (scpiMatch(header, "WFMOutpre") && query) reply(":WFMOUTPRE", preamble());
+		else if (scpiMatch(header, "WFMOutpre:NR_Pt")) reply(":WFMOUTPRE:NR_PT", std::to_string(transferPoints()));
+		else if (scpiMatch(header, "WFMOutpre:XINcr")) reply(":WFMOUTPRE:XINCR", num(cfg_.sampleInterval));
+		else if (scpiMatch(header, "WFMOutpre:XZEro")) reply(":WFMOUTPRE:XZERO", num(0.0));
+		else if (scpiMatch(header, "WFMOutpre:PT_Off")) reply(":WFMOUTPRE:PT_OFF", std::to_string(transferOffset()));
+		else if (scpiMatch(header, "WFMOutpre:YMUlt")) reply(":WFMOUTPRE:YMULT", num(ymult()));
+		else if (scpiMatch(header, "WFMOutpre:YZEro")) reply(":WFMOUTPRE:YZERO", num(0.0));
+		else if (scpiMatch(header, "WFMOutpre:YOFf")) reply(":WFMOUTPRE:YOFF", num(0.0));
+		else if (scpiMatch(header, "TRIGger:STATE")) {
+			if (stopAfterSequence_) reply(":TRIGGER:STATE", sequenceArmed_ && !sequenceRunning() ? "SAVE" : "READY");
+			else reply(":TRIGGER:STATE", triggered() ? "TRIGGER" : "READY");
+		}
+		else if (scpiMatch(header, "ACQuire:STOPAfter")) {
+			if (query) reply(":ACQUIRE:STOPAFTER", stopAfterSequence_ ? "SEQUENCE" : "RUNSTOP");
+			else stopAfterSequence_ = scpiMatch(arg, "SEQuence");
+		}
+		else if (scpiMatch(header, "ACQuire:NUMACq") && query) reply(":ACQUIRE:NUMACQ", std::to_string((countAcquisitions(), acquisitions_)));
+		else if (scpiMatch(header, "ACQuire:STATE")) {
+			if (query) reply(":ACQUIRE:STATE", sequenceRunning() ? "1" : "0");
+			else if ((arg == "1" || scpiMatch(arg, "ON") || scpiMatch(arg, "RUN")) && !sequenceRunning()) {	//a running sequence keeps waiting for its trigger
+				acquisitions_ = 0;					//NUMACq counts from the start of the acquisition
+				countedUntil_ = Clock::now();
+				if (stopAfterSequence_) armSequence();
+			}
+		}
+		else if (scpiMatch(header, "HORizontal:FASTframe:STATE")) {
+			if (query) reply(":HORIZONTAL:FASTFRAME:STATE", fastFrame_ ? "1" : "0");
+			else fastFrame_ = arg == "1" || scpiMatch(arg, "ON");
+		}
+		else if (scpiMatch(header, "HORizontal:FASTframe:COUNt")) {
+			if (query) reply(":HORIZONTAL:FASTFRAME:COUNT", std::to_string(frameCount_));
+			else frameCount_ = std::max<size_t>(1, std::strtoull(std::string(arg).c_str(), nullptr, 10));
+		}
+		else if (scpiMatch(header, "HORizontal:FASTframe:TIMEStamp:ALL:*") && query) {
+			waitForSequence();
+			reply(":HORIZONTAL:FASTFRAME:TIMESTAMP:ALL", frameTimestamps());
+		}
+		else if (scpiMatch(header, "DATa:FRAMESTARt")) frameStart_ = std::max<size_t>(1, std::strtoull(std::string(arg).c_str(), nullptr, 10));
+		else if (scpiMatch(header, "DATa:FRAMESTOP")) frameStop_ = std::max<size_t>(1, std::strtoull(std::string(arg).c_str(), nullptr, 10));
+		else if (scpiMatch(header, "TRIGger:A:MODe")) {}
+		else if (scpiMatch(header, "TRIGger:A:HOLDoff:BY")) holdoffByTime_ = scpiMatch(arg, "TIMe");
+		else if (scpiMatch(header, "TRIGger:A:HOLDoff:TIMe")) holdoffTime_ = std::atof(std::string(arg).c_str());
+		else if (scpiMatch(header, "TRIGger:A:EDGE:SOUrce") || scpiMatch(header, "TRIGger:A:EDGE:SLOpe")) {}
+		else if (scpiMatch(header, "TRIGger:A:LEVel:*")) {}
+		else if (scpiMatch(header, "ACQuire:FASTAcq:STATE")) {}
+		else if (scpiMatch(header, "PAUse")) {
+			std::this_thread::sleep_for(std::chrono::duration<double>(std::atof(std::string(arg).c_str())));
+		}
+		else if (scpiMatch(header, "SAVe:IMAGe")) {}
+		else if (scpiMatch(header, "FILESystem:READFile")) {
+			std::string& out = newOutput();
+			out.assign(cfg_.imageSize, '\0');
+			static const char png[] = "\x89PNG\r\n\x1a\n";
+			std::memcpy(&out[0], png, std::min(sizeof(png) - 1, out.size()));
+		}
+		else if (scpiMatch(header, "CURVe") && query) curve();
+		else if (scpiMatch(header, "CURVEStream") && query) streaming_ = true;
+		else errors_++;
+		holdoff_ = holdoffByTime_ ? holdoffTime_ : 0.0;
+	}
+
+	// Fills one acquisition worth of samples into out, IEEE 488.2 definite-length block.
+	// In FastFrame mode the selected frames are concatenated in a single block.
+	void curve() {
+		size_t nFrames = 1;
+		if (stopAfterSequence_) {
+			waitForSequence();
+			if (fastFrame_) {
+				size_t lastFrame = std::min(frameStop_, frameCount_);
+				nFrames = lastFrame >= frameStart_ ? lastFrame - frameStart_ + 1 : 0;
+			}
+		}
+		else {
+			if (!triggered()) std::this_thread::sleep_until(nextTrigger_);
+			countAcquisitions();
+			scheduleTrigger(Clock::now());
+		}
+
+		size_t first = firstPoint();
+		size_t nPts = transferPoints();
+		size_t nBytes = nFrames * nPts * width_;
+
+		std::string lenStr = std::to_string(nBytes);
+		std::string& out = newOutput();
+		out.reserve(2 + lenStr.size() + nBytes + 1);
+		out.push_back('#');
+		out.push_back(static_cast<char>('0' + lenStr.size()));
+		out.append(lenStr);
+		size_t payload = out.size();
+		out.resize(payload + nBytes);
+		out.push_back('\n');
+		for (size_t f = 0; f < nFrames; f++) {
+			if (stopAfterSequence_) {
+				// a stopped acquisition reads back the same waveform, whatever part of it is requested
+				std::mt19937_64 frozen(sequenceSeed_ + f);
+				synthesize(&out[payload + f * nPts * width_], first - 1, nPts, frozen);
+			}
+			else synthesize(&out[payload + f * nPts * width_], first - 1, nPts, rng_);
+		}
+	}
+
+	void synthesize(char* dst, size_t firstPoint, size_t nPts, std::mt19937_64& rng) {
+		double amp = std::max(0.0, std::normal_distribution<double>(cfg_.pulseAmplitude, 0.15 * cfg_.pulseAmplitude)(rng));
+		size_t noiseOffset = std::uniform_int_distribution<size_t>(0, noiseTable_.size() - 1)(rng);
+		size_t mask = noiseTable_.size() - 1;
+		double scale = 1.0 / ymult();
+		double fullScale = width_ == 1 ? 127.0 : 32767.0;
+		double ptOff = pointOffset();
+		double xinc = cfg_.sampleInterval;
+		// the pulse is negligible after ~12 decay constants, only that window is computed
+		size_t pulseBegin = static_cast<size_t>(std::ceil(ptOff));
+		size_t pulseEnd = static_cast<size_t>(ptOff + 12.0 * cfg_.decayTime / xinc) + 1;
+
+		if (noiseWidth_ != width_) {
+			// baseline noise is quantized once per sample width and replayed from a random offset
+			noiseCodes_.resize(noiseTable_.size());
+			for (size_t i = 0; i < noiseTable_.size(); i++) {
+				noiseCodes_[i] = static_cast<int16_t>(std::lround(std::max(-fullScale, std::min(fullScale, cfg_.noise * scale * noiseTable_[i]))));
+			}
+			noiseWidth_ = width_;
+		}
+		auto store = [&](size_t i, long v) {
+			if (width_ == 1) dst[i] = static_cast<char>(static_cast<int8_t>(v));
+			else {
+				// RIBinary is transmitted most significant byte first, SRIbinary least significant first
+				uint16_t u = static_cast<uint16_t>(static_cast<int16_t>(v));
+				dst[2 * i + littleEndian_] = static_cast<char>(u >> 8);
+				dst[2 * i + !littleEndian_] = static_cast<char>(u & 0xFF);
+			}
+		};
+
+		for (size_t i = 0; i < nPts; i++) {
+			store(i, noiseCodes_[(noiseOffset + firstPoint + i) & mask]);
+		}
+		size_t from = std::max(pulseBegin, firstPoint);
+		size_t to = std::min(pulseEnd, firstPoint + nPts);
+		for (size_t point = from; point < to; point++) {
+			double t = (point - ptOff) * xinc;
+			double code = noiseCodes_[(noiseOffset + point) & mask]
+				+ amp * scale * (1.0 - std::exp(-t / cfg_.riseTime)) * std::exp(-t / cfg_.decayTime);
+			store(point - firstPoint, std::lround(std::max(-fullScale, std::min(fullScale, code))));
+		}
+	}
+
+	Mso44SimConfig cfg_;
+	std::mt19937_64 rng_;
+	std::mt19937_64 acquisitionRng_;
+	Clock::time_point clockBase_;
+	int64_t wallBase_ = 0;			// ns since 1970 at clockBase_
+	std::vector<float> noiseTable_;
+	std::vector<int16_t> noiseCodes_;
+	int noiseWidth_ = 0;
+	std::deque<std::string> output_;
+	std::vector<std::string> spare_;
+	std::string path_, command_;
+	Clock::time_point nextTrigger_;
+
+	bool headers_ = true;
+	int width_ = 1;
+	bool littleEndian_ = false;
+	size_t recordLength_;
+	size_t start_ = 1;
+	size_t stop_;
+	bool holdoffByTime_ = false;
+	double holdoffTime_ = 0.0;
+	double holdoff_ = 0.0;
+	size_t errors_ = 0;
+
+	bool stopAfterSequence_ = false;
+	bool sequenceArmed_ = false;
+	Clock::time_point sequenceDone_;
+	uint64_t sequenceSeed_ = 0;
+	bool fastFrame_ = false;
+	size_t frameCount_ = 1;
+	size_t frameStart_ = 1;
+	size_t frameStop_ = 1;
+	std::vector<Clock::time_point> frameTimes_;	// trigger times of the frames of the last sequence
+	uint64_t acquisitions_ = 0;		// acquire:numacq?
+	bool streaming_ = false;
+	Clock::time_point countedUntil_;
+
+	uint8_t esr_ = 0;
+	uint8_t ese_ = 0;
+	uint8_t sre_ = 0;
+	bool opcPending_ = false;
+	size_t opcCount_ = 0;
+	Clock::time_point opcAt_;
+};
@@ -0,0 +1,196 @@
+//-------------------------------------------------------------------------------
+// Minimal VISA library backed by the in-process MSO44 simulator.
+// Link against it instead of NI-VISA (cmake -DMSO44_SIMULATOR=ON) to run the
+// acquisition code and benchmarks without an instrument.
+//-------------------------------------------------------------------------------
+#include <map>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <cstdio>
+#include <cstring>
+
+#include "visa.h"
+#include "visatype.h"
+#include "mso44_sim.h"
+
+namespace {
+
+struct SimSession {
+	std::unique_ptr<Mso44Sim> instrument;	// null for the resource manager
+	size_t readPos = 0;						// position inside the front response message
+	ViUInt32 timeout = 2000;
+	ViChar termChar = '\n';
+	bool termCharEnabled = false;
+	bool srqEnabled = false;
+	size_t srqDelivered = 0;				// operations complete already reported by viWaitOnEvent
+};
+
+std::map<ViSession, SimSession> sessions;
+ViSession nextSession = 1;
+
+SimSession* findSession(ViObject vi) {
+	auto it = sessions.find(vi);
+	return it == sessions.end() ? nullptr : &it->second;
+}
+
+} // namespace
+
+ViStatus _VI_FUNC viOpenDefaultRM(ViPSession vi) {
+	*vi = nextSession++;
+	sessions[*vi];
+	return VI_SUCCESS;
+}
+
+ViStatus _VI_FUNC viOpen(ViSession sesn, ViConstRsrc name, ViAccessMode mode, ViUInt32 timeout, ViPSession vi) {
+	if (findSession(sesn) == nullptr) return VI_ERROR_INV_OBJECT;
+	*vi = nextSession++;
+	sessions[*vi].instrument = std::make_unique<Mso44Sim>();
+	std::fprintf(stderr, "visasim: %s connected to simulated MSO44\n", name);
+	return VI_SUCCESS;
+}
+
+ViStatus _VI_FUNC viClose(ViObject vi) {
+	return sessions.erase(vi) ? VI_SUCCESS : VI_ERROR_INV_OBJECT;
+}
+
+ViStatus _VI_FUNC viSetAttribute(ViObject vi, ViAttr attrName, ViAttrState attrValue) {
+	SimSession* s = findSession(vi);
+	if (s == nullptr) return VI_ERROR_INV_OBJECT;
+	switch (attrName) {
+	case VI_ATTR_TMO_VALUE: s->timeout = static_cast<ViUInt32>(attrValue); break;
+	case VI_ATTR_TERMCHAR: s->termChar = static_cast<ViChar>(attrValue); break;
+	case VI_ATTR_TERMCHAR_EN: s->termCharEnabled = attrValue != VI_FALSE; break;
+	default: return VI_WARN_NSUP_ATTR_STATE;
+	}
+	return VI_SUCCESS;
+}
+
+ViStatus _VI_FUNC viGetAttribute(ViObject vi, ViAttr attrName, void _VI_PTR attrValue) {
+	SimSession* s = findSession(vi);
+	if (s == nullptr) return VI_ERROR_INV_OBJECT;
+	switch (attrName) {
+	case VI_ATTR_TMO_VALUE: *static_cast<ViUInt32*>(attrValue) = s->timeout; break;
+	case VI_ATTR_TERMCHAR: *static_cast<ViUInt8*>(attrValue) = static_cast<ViUInt8>(s->termChar); break;
+	case VI_ATTR_TERMCHAR_EN: *static_cast<ViBoolean*>(attrValue) = s->termCharEnabled ? VI_TRUE : VI_FALSE; break;
+	default: return VI_ERROR_NSUP_ATTR;
+	}
+	return VI_SUCCESS;
+}
+
+ViStatus _VI_FUNC viStatusDesc(ViObject vi, ViStatus status, ViChar _VI_FAR desc[]) {
+	const char* text = "Unknown status";
+	switch (status) {
+	case VI_SUCCESS: text = "Operation completed successfully."; break;
+	case VI_ERROR_TMO: text = "Timeout expired before operation completed."; break;
+	case VI_ERROR_INV_OBJECT: text = "The given session or object reference is invalid."; break;
+	case VI_ERROR_NSUP_ATTR: text = "The specified attribute is not supported."; break;
+	}
+	std::strcpy(desc, text);
+	return VI_SUCCESS;
+}
+
+ViStatus _VI_FUNC viWrite(ViSession vi, ViConstBuf buf, ViUInt32 cnt, ViPUInt32 retCnt) {
+	SimSession* s = findSession(vi);
+	if (s == nullptr || !s->instrument) return VI_ERROR_INV_OBJECT;
+	s->instrument->write(std::string_view(reinterpret_cast<const char*>(buf), cnt));
+	if (retCnt) *retCnt = cnt;
+	return VI_SUCCESS;
+}
+
+ViStatus _VI_FUNC viRead(ViSession vi, ViPBuf buf, ViUInt32 cnt, ViPUInt32 retCnt) {
+	SimSession* s = findSession(vi);
+	if (retCnt) *retCnt = 0;
+	if (s == nullptr || !s->instrument) return VI_ERROR_INV_OBJECT;
+	if (!s->instrument->hasOutput()) {
+		if (!s->instrument->streaming()) return VI_ERROR_TMO;
+		s->instrument->streamCurve();		// next block of CURVEStream?, waits for the trigger
+	}
+
+	// a read never crosses the end of the current response message (END indicator)
+	const std::string& msg = s->instrument->frontOutput();
+	size_t available = msg.size() - s->readPos;
+	size_t n = std::min<size_t>(available, cnt);
+	ViStatus status = VI_SUCCESS_MAX_CNT;
+	if (s->termCharEnabled) {
+		const void* term = std::memchr(msg.data() + s->readPos, s->termChar, n);
+		if (term != nullptr) {
+			n = static_cast<const char*>(term) - (msg.data() + s->readPos) + 1;
+			status = VI_SUCCESS_TERM_CHAR;
+		}
+	}
+	std::memcpy(buf, msg.data() + s->readPos, n);
+	s->readPos += n;
+	if (retCnt) *retCnt = static_cast<ViUInt32>(n);
+	if (s->readPos == msg.size()) {
+		s->instrument->popOutput();
+		s->readPos = 0;
+		status = VI_SUCCESS;
+	}
+	return status;
+}
+
+ViStatus _VI_FUNC viClear(ViSession vi) {
+	SimSession* s = findSession(vi);
+	if (s == nullptr || !s->instrument) return VI_ERROR_INV_OBJECT;
+	s->instrument->clear();
+	s->readPos = 0;
+	return VI_SUCCESS;
+}
+
+ViStatus _VI_FUNC viEnableEvent(ViSession vi, ViEventType eventType, ViUInt16 mechanism, ViEventFilter context) {
+	SimSession* s = findSession(vi);
+	if (s == nullptr || !s->instrument) return VI_ERROR_INV_OBJECT;
+	if (eventType != VI_EVENT_SERVICE_REQ || mechanism != VI_QUEUE) return VI_ERROR_INV_EVENT;
+	s->srqEnabled = true;
+	return VI_SUCCESS;
+}
+
+ViStatus _VI_FUNC viDisableEvent(ViSession vi, ViEventType eventType, ViUInt16 mechanism) {
+	SimSession* s = findSession(vi);
+	if (s == nullptr) return VI_ERROR_INV_OBJECT;
+	s->srqEnabled = false;
+	return VI_SUCCESS;
+}
+
+ViStatus _VI_FUNC viDiscardEvents(ViSession vi, ViEventType eventType, ViUInt16 mechanism) {
+	SimSession* s = findSession(vi);
+	if (s == nullptr) return VI_ERROR_INV_OBJECT;
+	if (s->instrument) s->srqDelivered = s->instrument->operationsCompleted();
+	return VI_SUCCESS;
+}
+
+ViStatus _VI_FUNC viWaitOnEvent(ViSession vi, ViEventType inEventType, ViUInt32 timeout, ViPEventType outEventType, ViPEvent outContext) {
+	using Clock = Mso44Sim::Clock;
+	SimSession* s = findSession(vi);
+	if (s == nullptr || !s->instrument) return VI_ERROR_INV_OBJECT;
+	if (inEventType != VI_EVENT_SERVICE_REQ || !s->srqEnabled) return VI_ERROR_NENABLED;
+
+	Clock::time_point deadline = timeout == VI_TMO_INFINITE ? Clock::time_point::max()
+		: Clock::now() + std::chrono::milliseconds(timeout);
+	while (true) {
+		if (s->instrument->requestingService() && s->instrument->operationsCompleted() != s->srqDelivered) break;
+
+		Clock::time_point when;
+		if (!s->instrument->pendingServiceRequest(when) || when > deadline) {
+			if (timeout != VI_TMO_INFINITE) std::this_thread::sleep_until(deadline);
+			return VI_ERROR_TMO;
+		}
+		std::this_thread::sleep_until(when);
+	}
+
+	s->srqDelivered = s->instrument->operationsCompleted();
+	if (outEventType) *outEventType = VI_EVENT_SERVICE_REQ;
+	if (outContext) {
+		*outContext = nextSession++;
+		sessions[*outContext];
+	}
+	return VI_SUCCESS;
+}
+
+ViStatus _VI_FUNC viReadSTB(ViSession vi, ViPUInt16 status) {
+	SimSession* s = findSession(vi);
+	if (s == nullptr || !s->instrument) return VI_ERROR_INV_OBJECT;
+	*status = s->instrument->statusByte();
+	return VI_SUCCESS;
+}
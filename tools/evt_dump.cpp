@@ -0,0 +1,48 @@
+//-------------------------------------------------------------------------------
+// Prints the header of a binary run file written by pcontrol (run.evt), or one
+// event as time,voltage csv lines.
+//
+// usage: evt_dump <run.evt> [event number]
+//-------------------------------------------------------------------------------
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstdint>
+
+#include "event_file.h"
+
+template<typename T>
+void dumpEvent(const EventFileReader& reader, size_t n) {
+	WaveformView<T> wf = reader.event<T>(n);
+	for (size_t i = 0; i < wf.size(); i++) {
+		std::cout << std::setprecision(5) << reader.time(i) << "," << reader.volts(wf[i]) << '\n';
+	}
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		std::cout << "usage: evt_dump <run.evt> [event number]\n";
+		return 1;
+	}
+	EventFileReader reader;
+	if (!reader.open(argv[1])) return 1;
+	const EventFileHeader& h = reader.header();
+
+	if (argc < 3) {
+		std::cout << "events:        " << reader.events() << (h.indexOffset == 0 ? " (file not closed)" : "") << '\n'
+			<< "sample bytes:  " << h.sampleBytes << '\n'
+			<< "record length: " << h.recordLength << '\n'
+			<< "xinc, xzero, pt_off: " << h.xinc << ", " << h.xzero << ", " << h.pt_off << '\n'
+			<< "ymult, yzero, yoff:  " << h.ymult << ", " << h.yzero << ", " << h.yoff << '\n';
+		return 0;
+	}
+
+	size_t n = std::strtoull(argv[2], nullptr, 10);
+	if (n < 1 || n > reader.events()) {
+		std::cout << "event number must be between 1 and " << reader.events() << '\n';
+		return 1;
+	}
+	if (h.sampleBytes == 2) dumpEvent<int16_t>(reader, n - 1);
+	else dumpEvent<int8_t>(reader, n - 1);
+	return 0;
+}
@@ -0,0 +1,42 @@
+//-------------------------------------------------------------------------------
+// Prints the pulse features written by pcontrol (pulses.dat) as csv, one line
+// per event.
+//
+// usage: pulse_dump <pulses.dat>
+//-------------------------------------------------------------------------------
+#include <iostream>
+#include <iomanip>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+#include "pulse_features.h"
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		std::cout << "usage: pulse_dump <pulses.dat>\n";
+		return 1;
+	}
+	std::FILE* file = std::fopen(argv[1], "rb");
+	if (file == nullptr) {
+		std::cout << "Error opening " << argv[1] << '\n';
+		return 1;
+	}
+	char magic[8];
+	uint32_t header[2];
+	if (std::fread(magic, 1, sizeof(magic), file) != sizeof(magic) || std::memcmp(magic, pulseFileMagic, sizeof(magic)) != 0
+		|| std::fread(header, sizeof(header), 1, file) != 1 || header[1] != sizeof(PulseFeatures)) {
+		std::cout << argv[1] << " is not a pulse file\n";
+		std::fclose(file);
+		return 1;
+	}
+
+	std::cout << "event,baseline,noise,amplitude,peak_time,rise_time,cfd_time,charge,flags\n" << std::setprecision(6);
+	PulseFeatures f;
+	while (std::fread(&f, sizeof(f), 1, file) == 1) {
+		std::cout << f.event << ',' << f.baseline << ',' << f.noise << ',' << f.amplitude << ',' << f.peakTime << ','
+			<< f.riseTime << ',' << f.cfdTime << ',' << f.charge << ',' << f.flags << '\n';
+	}
+	std::fclose(file);
+	return 0;
+}